@@ -0,0 +1,152 @@
+#include <malloc.h> // for malloc_usable_size
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+#include "allocation_stats.hh"
+
+#if defined(COUNT_ALLOCATIONS)
+
+// The global operator new and delete are replaced to count the allocations
+// of the whole program. The sizes are the ones malloc actually reserved,
+// which are known at deallocation time too. Every allocation pays for the
+// counting, the player's too: hence a build of its own.
+
+static std::atomic<uint64_t> nb_allocations { 0 };
+static std::atomic<std::size_t> current_bytes { 0 };
+static std::atomic<std::size_t> peak_bytes { 0 };
+
+static void* counted_malloc(std::size_t size)
+{
+  void* const res = std::malloc(size == 0 ? 1 : size);
+  if (res == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+
+  const auto size_reserved = malloc_usable_size(res);
+  nb_allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto bytes = current_bytes.fetch_add(size_reserved, std::memory_order_relaxed) + size_reserved;
+
+  auto peak = peak_bytes.load(std::memory_order_relaxed);
+  while ((bytes > peak) and (not peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)))
+  {
+  }
+
+  return res;
+}
+
+static void counted_free(void* ptr)
+{
+  if (ptr != nullptr)
+  {
+    current_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+  }
+}
+
+void* operator new(std::size_t size)
+{
+  return counted_malloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+  return counted_malloc(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  try
+  {
+    return counted_malloc(size);
+  }
+  catch (std::bad_alloc&)
+  {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  try
+  {
+    return counted_malloc(size);
+  }
+  catch (std::bad_alloc&)
+  {
+    return nullptr;
+  }
+}
+
+void operator delete(void* ptr) noexcept
+{
+  counted_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  counted_free(ptr);
+}
+
+// the sized versions are only declared by <new> from C++14 on, but may be
+// called by code compiled with -fsized-deallocation
+#if not defined(__cpp_sized_deallocation)
+void operator delete(void* ptr, std::size_t size) noexcept;
+void operator delete[](void* ptr, std::size_t size) noexcept;
+#endif
+
+void operator delete(void* ptr, std::size_t /* size */) noexcept
+{
+  counted_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t /* size */) noexcept
+{
+  counted_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+  counted_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+  counted_free(ptr);
+}
+
+bool are_allocations_counted()
+{
+  return true;
+}
+
+struct allocation_stats get_allocation_stats()
+{
+  return { nb_allocations.load(std::memory_order_relaxed),
+	   current_bytes.load(std::memory_order_relaxed),
+	   peak_bytes.load(std::memory_order_relaxed) };
+}
+
+void reset_peak_bytes()
+{
+  peak_bytes.store(current_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+#else
+
+bool are_allocations_counted()
+{
+  return false;
+}
+
+struct allocation_stats get_allocation_stats()
+{
+  return { 0, 0, 0 };
+}
+
+void reset_peak_bytes()
+{
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ALLOCATION_STATS_HH_
+#define ALLOCATION_STATS_HH_
+
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+// what went through operator new and delete since the program started.
+// Only counted in the builds made with COUNT_ALLOCATIONS=1: otherwise the
+// global operator new and delete are left alone, and everything is 0.
+struct allocation_stats
+{
+    uint64_t nb_allocations;
+    std::size_t current_bytes; // allocated and not freed yet
+    std::size_t peak_bytes; // maximum of current_bytes, since the last reset_peak_bytes
+};
+
+bool are_allocations_counted() __attribute__((const));
+
+#if defined(COUNT_ALLOCATIONS)
+struct allocation_stats get_allocation_stats();
+#else
+struct allocation_stats get_allocation_stats() __attribute__((const));
+#endif
+
+// starts a new measure of peak_bytes, from the current bytes
+void reset_peak_bytes();
+
+#endif /* ALLOCATION_STATS_HH_ */
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Times each stage of pianoterm on synthetic songs of growing sizes, and
+# fails if the time per note of a stage grows too much with the size, which
+# is what a quadratic stage does.
+#
+# usage: bench_stages.sh <pianoterm> <midi_corpus> <corpus_dir> <nb_notes>...
+#
+# The generated songs are kept in corpus_dir, and reused as long as the
+# generator options don't change. MAX_GROWTH (default 4) is how many times
+# slower per note a stage may get from the smallest size to the biggest.
+# CORPUS_OPTIONS is given to midi_corpus, on top of the number of notes.
+
+set -e
+
+if [ $# -lt 4 ]
+then
+  echo "usage: $0 <pianoterm> <midi_corpus> <corpus_dir> <nb_notes>..." >&2
+  exit 2
+fi
+
+pianoterm="$1"
+midi_corpus="$2"
+corpus_dir="$3"
+shift 3
+
+max_growth="${MAX_GROWTH:-4}"
+corpus_options="${CORPUS_OPTIONS:---tracks 16 --polyphony 4 --tempo-changes 16 --sysex 64}"
+options_tag=$(printf '%s' "${corpus_options}" | tr -c 'a-zA-Z0-9' '_')
+
+mkdir -p "${corpus_dir}"
+
+results=$(mktemp)
+trap 'rm -f "${results}"' EXIT
+
+for nb_notes in "$@"
+do
+  song="${corpus_dir}/synthetic_${nb_notes}_${options_tag}.mid"
+  if [ ! -f "${song}" ]
+  then
+    # shellcheck disable=SC2086 # the options must be split
+    "${midi_corpus}" --notes "${nb_notes}" ${corpus_options} --output "${song}"
+  fi
+
+  # stage wall_time: the loading stages, then the playing through the
+  # scheduler, the renderer and the output.
+  "${pianoterm}" --no-cache --profile "${song}" |
+    awk -v n="${nb_notes}" '$2 ~ /ms$/ { sub(/ms$/, "", $2); print n, $1, $2 }' >> "${results}"
+  "${pianoterm}" --no-cache --bench "${song}" |
+    awk -v n="${nb_notes}" '$1 == "played" { sub(/s$/, "", $6); print n, "playback", $6 * 1000 }' >> "${results}"
+done
+
+awk -v max_growth="${max_growth}" '
+  {
+    if (!($2 in first_size)) { first_size[$2] = $1; first_ns[$2] = $3 * 1e6 / $1; stages[++nb_stages] = $2 }
+    last_size[$2] = $1
+    last_ns[$2] = $3 * 1e6 / $1
+    printf "%12d notes  %-20s %12.3fms %10.1fns/note\n", $1, $2, $3, $3 * 1e6 / $1
+  }
+  END {
+    status = 0
+    for (i = 1; i <= nb_stages; ++i)
+    {
+      s = stages[i]
+      if ((last_size[s] > first_size[s]) && (first_ns[s] > 0) && (last_ns[s] > max_growth * first_ns[s]))
+      {
+        printf "%s: %.1fns/note at %d notes, %.1fns/note at %d notes: it doesn'\''t scale linearly\n", s, first_ns[s], first_size[s], last_ns[s], last_size[s]
+        status = 1
+      }
+    }
+    exit status
+  }' "${results}"
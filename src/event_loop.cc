@@ -0,0 +1,195 @@
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "event_loop.hh"
+#include "signals_handler.hh"
+
+enum fd_tag : uint32_t
+{
+  tty_tag,
+  signal_tag,
+  timer_tag,
+  wake_up_tag,
+};
+
+static int check(int ret, const char* what)
+{
+  if (ret == -1)
+  {
+    throw std::runtime_error(std::string{"Error while "} + what + ": " + std::strerror(errno));
+  }
+  return ret;
+}
+
+static void watch(int epoll_fd, int fd, enum fd_tag tag)
+{
+  struct epoll_event ev;
+  std::memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  check(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev), "watching a file descriptor");
+}
+
+// reads everything from a non blocking file descriptor, the last value read
+// being left in data.
+template <typename T>
+static void drain(int fd, T& data)
+{
+  while (read(fd, &data, sizeof(data)) == sizeof(data))
+  {
+  }
+}
+
+event_loop::event_loop()
+  : epoll_fd (-1)
+  , tty_fd (-1)
+  , signal_fd (-1)
+  , timer_fd (-1)
+  , wake_up_fd (-1)
+{
+  try
+  {
+    epoll_fd = check(epoll_create1(EPOLL_CLOEXEC), "creating the event loop");
+
+    // termbox reads the terminal from its own descriptor, which it keeps
+    // for itself. Input on one is input on the other: this one is only
+    // watched, termbox still does the reading.
+    tty_fd = check(open("/dev/tty", O_RDONLY | O_NONBLOCK | O_CLOEXEC), "opening the terminal");
+    watch(epoll_fd, tty_fd, tty_tag);
+
+    const auto signals = handled_signals();
+    signal_fd = check(signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC), "creating the signal descriptor");
+    watch(epoll_fd, signal_fd, signal_tag);
+
+    timer_fd = check(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC), "creating the timer");
+    watch(epoll_fd, timer_fd, timer_tag);
+
+    wake_up_fd = check(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "creating the wake up descriptor");
+    watch(epoll_fd, wake_up_fd, wake_up_tag);
+  }
+  catch (...)
+  {
+    close_all();
+    throw;
+  }
+}
+
+event_loop::~event_loop()
+{
+  close_all();
+}
+
+void event_loop::close_all()
+{
+  for (const auto fd : { wake_up_fd, timer_fd, signal_fd, tty_fd, epoll_fd })
+  {
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+}
+
+void event_loop::wait(struct loop_events& events)
+{
+  events = loop_events();
+
+  struct epoll_event ready[4];
+  const auto nb_ready = epoll_wait(epoll_fd, ready, 4, -1 /* no timeout */);
+  if (nb_ready == -1)
+  {
+    if (errno != EINTR)
+    {
+      check(-1, "waiting for events");
+    }
+
+    // only the signals which are not handled here interrupt the wait, in
+    // particular the SIGWINCH termbox catches to know about resizes.
+    events.terminal = true;
+    return;
+  }
+
+  for (int i = 0; i < nb_ready; ++i)
+  {
+    switch (ready[i].data.u32)
+    {
+      case tty_tag:
+	events.terminal = true;
+	break;
+
+      case signal_tag:
+      {
+	struct signalfd_siginfo info;
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+	{
+	  events.signals.push_back(static_cast<int>(info.ssi_signo));
+	}
+	break;
+      }
+
+      case timer_tag:
+      {
+	uint64_t nb_expirations;
+	drain(timer_fd, nb_expirations);
+	events.timer = true;
+	break;
+      }
+
+      case wake_up_tag:
+      {
+	uint64_t nb_wake_ups;
+	drain(wake_up_fd, nb_wake_ups);
+	events.woken_up = true;
+	break;
+      }
+
+      default:
+	break;
+    }
+  }
+}
+
+void event_loop::set_timer(std::chrono::nanoseconds deadline)
+{
+  struct itimerspec value;
+  std::memset(&value, 0, sizeof(value));
+
+  using timespec_seconds = std::chrono::duration<decltype(value.it_value.tv_sec)>;
+  using timespec_nanoseconds = std::chrono::duration<decltype(value.it_value.tv_nsec), std::nano>;
+
+  const auto secs = std::chrono::duration_cast<timespec_seconds>(deadline);
+  value.it_value.tv_sec = secs.count();
+  value.it_value.tv_nsec = std::chrono::duration_cast<timespec_nanoseconds>(deadline - secs).count();
+
+  // an all zero time would stop the timer instead
+  if ((value.it_value.tv_sec == 0) and (value.it_value.tv_nsec == 0))
+  {
+    value.it_value.tv_nsec = 1;
+  }
+
+  check(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &value, nullptr), "setting the timer");
+}
+
+void event_loop::stop_timer()
+{
+  struct itimerspec value;
+  std::memset(&value, 0, sizeof(value));
+  check(timerfd_settime(timer_fd, 0, &value, nullptr), "stopping the timer");
+}
+
+void event_loop::wake_up()
+{
+  const uint64_t one = 1;
+  // can only fail if the counter would overflow: there are plenty of wake
+  // ups pending then.
+  const auto ret = write(wake_up_fd, &one, sizeof(one));
+  static_cast<void>(ret);
+}
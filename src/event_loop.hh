@@ -0,0 +1,56 @@
+#ifndef EVENT_LOOP_HH_
+#define EVENT_LOOP_HH_
+
+#include <chrono>
+#include <vector>
+
+// what woke the event loop up
+struct loop_events
+{
+    bool terminal; // the terminal has input, or was resized
+    bool timer; // the timer expired
+    bool woken_up; // another thread called wake_up()
+    std::vector<int> signals; // the handled signals received
+
+    loop_events()
+      : terminal (false)
+      , timer (false)
+      , woken_up (false)
+      , signals ()
+    {
+    }
+};
+
+// sleeps until something actually happens: input on the terminal, one of
+// the handled signals (see block_handled_signals), the timer expiring, or
+// another thread asking for it. All of them are waited for with a single
+// epoll.
+class event_loop
+{
+  public:
+    event_loop();
+    ~event_loop();
+
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    void wait(struct loop_events& events);
+
+    // the timer expires at the given CLOCK_MONOTONIC time, once
+    void set_timer(std::chrono::nanoseconds deadline);
+    void stop_timer();
+
+    // can be called from any thread
+    void wake_up();
+
+  private:
+    void close_all();
+
+    int epoll_fd;
+    int tty_fd;
+    int signal_fd;
+    int timer_fd;
+    int wake_up_fd;
+};
+
+#endif /* EVENT_LOOP_HH_ */
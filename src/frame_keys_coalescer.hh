@@ -0,0 +1,92 @@
+#ifndef FRAME_KEYS_COALESCER_HH_
+#define FRAME_KEYS_COALESCER_HH_
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "keyboard_events_extractor.hh"
+#include "spsc_ring.hh"
+
+// 16384 key events is way more than what a terminal can show in between two
+// frames, even a slow one.
+using key_events_ring = spsc_ring<struct key_data, 16384>;
+
+// merges the key events played between two frames. A key pressed and
+// released within the same frame would never be seen on screen, so its
+// release is postponed to the next frame.
+class frame_keys_coalescer
+{
+  public:
+    frame_keys_coalescer()
+      : pressed_in_frame ()
+      , is_release_postponed ()
+      , postponed_releases ()
+    {
+    }
+
+    // gives the key events to show in the coming frame: the releases
+    // postponed from the previous frame, then the key events played since.
+    void next_frame(key_events_ring& played_keys, std::vector<struct key_data>& frame_keys)
+    {
+      frame_keys.clear();
+      pressed_in_frame.fill(false);
+
+      for (const auto pitch : postponed_releases)
+      {
+	if (is_release_postponed[pitch])
+	{
+	  is_release_postponed[pitch] = false;
+	  frame_keys.emplace_back(pitch, key_data::type::released);
+	}
+      }
+      postponed_releases.clear();
+
+      struct key_data key;
+      while (played_keys.pop(key))
+      {
+	switch (key.ev_type)
+	{
+	  case key_data::type::pressed:
+	    pressed_in_frame[key.pitch] = true;
+	    is_release_postponed[key.pitch] = false; // pressed again in the same frame
+	    frame_keys.push_back(key);
+	    break;
+
+	  case key_data::type::released:
+	    if (not pressed_in_frame[key.pitch])
+	    {
+	      frame_keys.push_back(key);
+	    }
+	    else if (not is_release_postponed[key.pitch])
+	    {
+	      is_release_postponed[key.pitch] = true;
+	      postponed_releases.push_back(key.pitch);
+	    }
+	    break;
+
+#if !defined(__clang__)
+// clang complains that all values are handled in the switch and issue
+// a warning for the default case
+// gcc complains about a missing default
+	  default:
+	    __builtin_unreachable();
+#endif
+	}
+      }
+    }
+
+    // some keys pressed and released in the last frame are still shown
+    // pressed: another frame is needed, even if nothing else is played.
+    bool has_postponed_releases() const
+    {
+      return not postponed_releases.empty();
+    }
+
+  private:
+    std::array<bool, 256> pressed_in_frame;
+    std::array<bool, 256> is_release_postponed;
+    std::vector<uint8_t> postponed_releases;
+};
+
+#endif /* FRAME_KEYS_COALESCER_HH_ */
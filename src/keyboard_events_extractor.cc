@@ -1,15 +1,28 @@
 #include <stdexcept>
 #include <algorithm>
 #include <chrono>
+#include <array>
+#include <limits>
+#include <cstddef> // for std::size_t
 #include "keyboard_events_extractor.hh"
+#include "tempo_map.hh"
 #include "utils.hh"
 
 
-static
-void separate_release_pressed_events(std::vector<struct key_event>& key_events)
+constexpr const std::chrono::nanoseconds key_events_extractor::max_release_advance;
+
+key_events_extractor::key_events_extractor()
+  : pitches ()
+  , last_time (std::chrono::nanoseconds::min())
+{
+  pitches.fill(pitch_state{ false, std::chrono::nanoseconds{ 0 }, 0 });
+}
+
+// works on the events from begin to the end of key_events.
+void key_events_extractor::separate_release_pressed_events(std::vector<struct key_event>& key_events, std::size_t begin)
 {
   // precond the events MUST be sorted by time. this function only works on that case
-  if (not std::is_sorted(key_events.begin(), key_events.end(), [] (const key_event& a, const key_event& b) {
+  if (not std::is_sorted(key_events.begin() + static_cast<std::ptrdiff_t>(begin), key_events.end(), [] (const key_event& a, const key_event& b) {
 	return a.time < b.time;
       }))
   {
@@ -20,120 +33,155 @@ void separate_release_pressed_events(std::vector<struct key_event>& key_events)
   // at the exact same time as its associated release event. If so, shorten the
   // duration of the former pressed event (i.e advance the time the release
   // event occurs).
+  //
+  // The events are swept once, one group of events occuring at the same time
+  // after the other, keeping track of the state of each pitch.
+  const auto nb_events = key_events.size();
+  auto group_begin = begin;
 
-  // suboptimal implementation in the case the key_events are sorted
-  for (auto& k : key_events)
+  while (group_begin < nb_events)
   {
-    if (k.data.ev_type == key_data::type::pressed)
-    {
-      const auto pitch = k.data.pitch;
-      const auto earliest_time = k.time;
+    const auto time = key_events[group_begin].time;
 
-      // is there a realease happening at the same time?
-      auto release_pos = std::find_if(key_events.begin(), key_events.end(), [=] (const key_event& elt) {
-	  return (elt.time == earliest_time) and (elt.data.ev_type == key_data::type::released) and (elt.data.pitch == pitch);
-	});
+    auto group_end = group_begin;
+    for (; (group_end < nb_events) and (key_events[group_end].time == time); ++group_end)
+    {
+      pitches[key_events[group_end].data.pitch].next_release_pos = group_begin;
+    }
 
-      if (release_pos != key_events.end())
+    for (auto i = group_begin; i < group_end; ++i)
+    {
+      if (key_events[i].data.ev_type == key_data::type::pressed)
       {
+	const auto pitch = key_events[i].data.pitch;
+	auto& state = pitches[pitch];
+
+	// is there a realease happening at the same time?
+	auto release_pos = state.next_release_pos;
+	while ((release_pos < group_end) and
+	       ((key_events[release_pos].data.ev_type != key_data::type::released) or
+		(key_events[release_pos].data.pitch != pitch)))
+	{
+	  release_pos++;
+	}
 
-	// there do is a release key happening at the same time.
-	// Let's find the pressed key responsible for it
-	const auto note_start_pos = std::find_if(key_events.rbegin(), key_events.rend(), [=] (const key_event& elt) {
-	  return (elt.time < earliest_time) and (elt.data.ev_type == key_data::type::pressed) and (elt.data.pitch == pitch);
-	});
+	if (release_pos == group_end)
+	{
+	  state.next_release_pos = group_end;
+	  continue;
+	}
 
+	state.next_release_pos = release_pos + 1;
+
+	// there do is a release key happening at the same time.
 	// sanity check: a release event must be preceded by a pressed event.
-	if (note_start_pos == key_events.rend())
+	if (not state.has_been_pressed)
 	{
 	  throw std::invalid_argument("error, a there is release event comming from nowhere (failed to find the associated pressed event)");
 	}
 
 	// compute the shortening time
-	const auto duration = release_pos->time - note_start_pos->time;
-	constexpr const std::chrono::nanoseconds max_shortening_time {75000000};
-
+	auto& release = key_events[release_pos];
+	const auto duration = release.time - state.last_pressed_time;
 	// shorten the duration by one fourth of its time, in the worst case
-	const std::chrono::nanoseconds shortening_time { std::min(static_cast<decltype(duration)>(max_shortening_time.count()),
+	const std::chrono::nanoseconds shortening_time { std::min(static_cast<decltype(duration)>(max_release_advance.count()),
 								  duration / 4) } ;
-	release_pos->time -= shortening_time;
-
+	release.time -= shortening_time;
       }
     }
-  }
 
-  // sanity check: a key release and a key pressed event with the same pitch
-  // can't appear at the same time any more
-  for (const auto& k : key_events)
-  {
-    if (k.data.ev_type == key_data::type::released)
+    for (auto i = group_begin; i < group_end; ++i)
     {
-      const auto pitch = k.data.pitch;
-      const auto time = k.time;
-
-      if (std::any_of(key_events.begin(), key_events.end(), [=] (const struct key_event& a) {
-  	    return (a.data.ev_type == key_data::type::pressed) and (a.data.pitch == pitch) and (a.time == time);
-  	  }))
+      if (key_events[i].data.ev_type == key_data::type::pressed)
       {
-	// technically nothing prevents a midi file from having an event appearing twice
-	// at the same time. While this should result in nothing special, it messes up
-	// with the separate pressed/released event. Indeed, if two release event appear
-	// at the exact same time, and the release event should be advanced, only one of
-	// them will. Therefore, at the end of the processing, there will still be a
-	// pressed/release at the same time.
-	//
-	// One can argue that this can't happen with proper midi files. Well, truth is
-	// that some midi files contain music played by several instruments at the same
-	// time. Since pianoterm doesn't keep track of the instrument playing a note,
-	// and doesn't filter out any non-piano instrument, it can actually happen with
-	// absolutely normal files.  Pianoterm will plays the note for all instruments
-	// with a piano. Therefore, it is enough that two instruments stops playing a
-	// note at the same time to trigger this problem.
-	//
-	// One solution would be to remove duplicated events. However this solution
-	// would bring other problems, like getting a released (resp. pressed) event
-	// without a matching pressed (resp. released).
-	//
-	// Another one would be to advance all identic released events. This solution
-	// could also bring other problems/
-	//
-	// Due to the goals of pianoterm, if the problem of duplicate events appears,
-	// the file will simply be rejected instead of "automagically fixed".
-
-  	throw std::invalid_argument("Error: a key is said to be pressed and released at the same time");
+	auto& state = pitches[key_events[i].data.pitch];
+	state.has_been_pressed = true;
+	state.last_pressed_time = time;
       }
     }
-  }
 
+    // sanity check: a key release and a key pressed event with the same pitch
+    // can't appear at the same time any more.
+    //
+    // Only the release events left in this group need to be checked: an
+    // advanced release event lands strictly between the previous pressed event
+    // of its pitch and the current time, where no pressed event of that pitch
+    // exists.
+    for (auto i = group_begin; i < group_end; ++i)
+    {
+      const auto& k = key_events[i];
+      if ((k.data.ev_type == key_data::type::released) and (k.time == time))
+      {
+	const auto& state = pitches[k.data.pitch];
+	if (state.has_been_pressed and (state.last_pressed_time == time))
+	{
+	  // technically nothing prevents a midi file from having an event appearing twice
+	  // at the same time. While this should result in nothing special, it messes up
+	  // with the separate pressed/released event. Indeed, if two release event appear
+	  // at the exact same time, and the release event should be advanced, only one of
+	  // them will. Therefore, at the end of the processing, there will still be a
+	  // pressed/release at the same time.
+	  //
+	  // One can argue that this can't happen with proper midi files. Well, truth is
+	  // that some midi files contain music played by several instruments at the same
+	  // time. Since pianoterm doesn't keep track of the instrument playing a note,
+	  // and doesn't filter out any non-piano instrument, it can actually happen with
+	  // absolutely normal files.  Pianoterm will plays the note for all instruments
+	  // with a piano. Therefore, it is enough that two instruments stops playing a
+	  // note at the same time to trigger this problem.
+	  //
+	  // One solution would be to remove duplicated events. However this solution
+	  // would bring other problems, like getting a released (resp. pressed) event
+	  // without a matching pressed (resp. released).
+	  //
+	  // Another one would be to advance all identic released events. This solution
+	  // could also bring other problems/
+	  //
+	  // Due to the goals of pianoterm, if the problem of duplicate events appears,
+	  // the file will simply be rejected instead of "automagically fixed".
+
+	  throw std::invalid_argument("Error: a key is said to be pressed and released at the same time");
+	}
+      }
+    }
 
+    group_begin = group_end;
+  }
 }
 
 
 
-std::vector<struct key_event>
-get_key_events(const std::vector<struct midi_event>& midi_events)
+void key_events_extractor::extract(const struct midi_event* first, const struct midi_event* last,
+				   const class tempo_map& tempo, std::vector<struct key_event>& res)
 {
-  // sanity check: precondition: the midi events must be sorted by time
-  if (not std::is_sorted(midi_events.begin(), midi_events.end(), [] (const struct midi_event& a, const struct midi_event& b) {
-	return a.time < b.time;
-      }))
+  // sanity check: precondition: the midi events must be sorted by time, and
+  // come after the ones of the previous pieces
+  if ((not std::is_sorted(first, last, [] (const struct midi_event& a, const struct midi_event& b) {
+	  return a.tick < b.tick;
+	})) or
+      ((first != last) and (tempo.time_of(first->tick) <= last_time)))
   {
     throw std::invalid_argument("Error: precondition failed. The midi events must be sorted by ordering time.");
   }
 
-  std::vector<struct key_event> res;
-  for (const auto& ev : midi_events)
+  if (first != last)
+  {
+    last_time = tempo.time_of((last - 1)->tick);
+  }
+
+  const auto begin = res.size();
+  for (const auto& ev : array_view<struct midi_event>{ first, last })
   {
     if (is_key_down_event(ev))
     {
-      res.emplace_back(ev.time /* time */,
+      res.emplace_back(tempo.time_of(ev.tick) /* time */,
 		       ev.data[1] /* pitch */,
 		       key_data::type::pressed /* event type */);
     }
 
     if (is_key_release_event(ev))
     {
-      res.emplace_back(ev.time /* time */,
+      res.emplace_back(tempo.time_of(ev.tick) /* time */,
 		       ev.data[1] /* pitch */,
 		       key_data::type::released /* event type */);
     }
@@ -146,15 +194,22 @@ get_key_events(const std::vector<struct midi_event>& midi_events)
   }
 
   // sanity check: the res vector should be sorted by event time
-  if (not std::is_sorted(res.begin(), res.end(), [] (const struct key_event& a, const struct key_event& b) {
+  if (not std::is_sorted(res.begin() + static_cast<std::ptrdiff_t>(begin), res.end(), [] (const struct key_event& a, const struct key_event& b) {
 	return a.time < b.time;
       }))
   {
     throw std::invalid_argument("Error: postcondition failed. The key events must be sorted by ordering time.");
   }
 
-  separate_release_pressed_events(res);
+  separate_release_pressed_events(res, begin);
   // res is not sorted anymore (because some release events got advanced)
+}
 
+std::vector<struct key_event>
+get_key_events(const std::vector<struct midi_event>& midi_events, const class tempo_map& tempo)
+{
+  std::vector<struct key_event> res;
+  key_events_extractor extractor;
+  extractor.extract(midi_events.data(), midi_events.data() + midi_events.size(), tempo, res);
   return res;
 }
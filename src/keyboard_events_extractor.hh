@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <chrono>
+#include <array>
+#include <limits>
+#include <cstddef> // for std::size_t
 #include "midi_reader.hh"
 
 struct key_data
@@ -16,6 +19,12 @@ struct key_data
     uint8_t  pitch; // the key that is pressed or released
     type     ev_type; // was the key pressed or released?
 
+    key_data()
+      : pitch(0)
+      , ev_type(type::released)
+    {
+    }
+
     key_data(decltype(key_data::pitch) init_pitch,
 	     decltype(key_data::ev_type) init_type)
       : pitch(init_pitch)
@@ -32,6 +41,8 @@ struct key_event
 
     key_event(const key_event& other) = default;
     key_event(key_event&& other) = default;
+    key_event& operator=(const key_event& other) = default;
+    key_event& operator=(key_event&& other) = default;
 
     key_event(decltype(key_event::time) init_time,
 	      decltype(key_data::pitch) init_pitch,
@@ -42,9 +53,48 @@ struct key_event
     }
 };
 
-// extracts the key_pressed / key_released from the midi events
+// extracts the key_pressed / key_released from the midi events, timed by the
+// tempo map of the song
 std::vector<struct key_event>
-get_key_events(const std::vector<struct midi_event>& midi_events);
+get_key_events(const std::vector<struct midi_event>& midi_events, const class tempo_map& tempo);
+
+// same as get_key_events, for a song read one piece after the other in time
+// order. A piece must hold all the midi events occuring at its times.
+//
+// The release events which get advanced (see get_key_events) are moved at
+// most max_release_advance earlier, which is how far back a piece can
+// change the key events of the previous ones.
+class key_events_extractor
+{
+  public:
+    static constexpr const std::chrono::nanoseconds max_release_advance { 75000000 };
+
+    key_events_extractor();
+
+    // appends the key events of the midi events [first, last) to res. The
+    // tempo map must hold the tempo changes up to these events.
+    void extract(const struct midi_event* first, const struct midi_event* last,
+		 const class tempo_map& tempo, std::vector<struct key_event>& res);
+
+  private:
+    void separate_release_pressed_events(std::vector<struct key_event>& key_events, std::size_t begin);
+
+    struct pitch_state
+    {
+	// the latest pressed event strictly before the current group
+	bool has_been_pressed;
+	std::chrono::nanoseconds last_pressed_time;
+
+	// in the current group, where to look for the next release event of
+	// this pitch. The ones before were either already advanced, or are not
+	// release events of this pitch.
+	std::size_t next_release_pos;
+    };
+
+    // a pitch is a uint8_t, although only the first 128 are valid midi pitches
+    std::array<struct pitch_state, std::numeric_limits<uint8_t>::max() + 1> pitches;
+    std::chrono::nanoseconds last_time; // of the previous pieces
+};
 
 
 #endif /* KEYBOARD_EVENTS_EXTRACTOR_HH_ */
@@ -0,0 +1,202 @@
+#include <sys/stat.h>
+#include <dirent.h>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <iomanip>
+#include <exception>
+
+#include "library_check.hh"
+#include "midi_reader.hh"
+#include "keyboard_events_extractor.hh"
+#include "utils.hh"
+#include "parallel.hh"
+
+struct checked_file
+{
+    std::string path;
+    std::size_t size; // to check the biggest files first
+    std::string error; // empty if the file is valid
+    std::chrono::nanoseconds duration;
+
+    checked_file(const std::string& init_path, std::size_t init_size, const std::string& init_error)
+      : path (init_path)
+      , size (init_size)
+      , error (init_error)
+      , duration (0)
+    {
+    }
+};
+
+static bool has_midi_extension(const std::string& filename)
+{
+  std::string extension = filename.substr(std::min(filename.rfind('.'), filename.size()));
+  std::transform(extension.begin(), extension.end(), extension.begin(), [] (char c) {
+      return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    });
+
+  return (extension == ".mid") or (extension == ".midi");
+}
+
+// the directories already searched, by device and inode: a symbolic link
+// back to a parent, or to a directory seen elsewhere, is searched once.
+using visited_directories = std::set<std::pair<dev_t, ino_t>>;
+
+// appends the files to check found at path. The errors met while searching
+// are reported as invalid files.
+static void find_files(const std::string& path, bool is_explicit, visited_directories& visited,
+		       std::vector<struct checked_file>& files)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) == -1)
+  {
+    files.emplace_back(path, 0, std::string{"Error: "} + std::strerror(errno));
+    return;
+  }
+
+  if (not S_ISDIR(info.st_mode))
+  {
+    // the files given explicitly are checked whatever their name
+    if (is_explicit or (S_ISREG(info.st_mode) and has_midi_extension(path)))
+    {
+      files.emplace_back(path, static_cast<std::size_t>(info.st_size), "");
+    }
+    return;
+  }
+
+  if (not visited.emplace(info.st_dev, info.st_ino).second)
+  {
+    return;
+  }
+
+  DIR* const dir = opendir(path.c_str());
+  if (dir == nullptr)
+  {
+    files.emplace_back(path, 0, std::string{"Error: unable to open directory: "} + std::strerror(errno));
+    return;
+  }
+  SCOPE_EXIT(closedir(dir));
+
+  std::vector<std::string> entries;
+  while (const struct dirent* const entry = readdir(dir))
+  {
+    const std::string name = entry->d_name;
+    if ((name != ".") and (name != ".."))
+    {
+      entries.push_back(name);
+    }
+  }
+
+  // same order from one run to the other
+  std::sort(entries.begin(), entries.end());
+
+  const auto prefix = (path.back() == '/') ? path : path + "/";
+  for (const auto& name : entries)
+  {
+    find_files(prefix + name, false, visited, files);
+  }
+}
+
+// the same checks as when the file is played
+static void check_file(struct checked_file& file)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  try
+  {
+    // the files are already checked in parallel
+    class tempo_map tempo;
+    const auto midi_events = get_midi_events(file.path, tempo, sequential_decoding);
+    const auto key_events = get_key_events(midi_events, tempo);
+    group_events_by_time(midi_events, key_events, tempo);
+  }
+  catch (std::exception& e)
+  {
+    file.error = e.what();
+  }
+
+  file.duration = std::chrono::steady_clock::now() - start;
+}
+
+static double to_ms(std::chrono::nanoseconds duration)
+{
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static void print_verdict(const struct checked_file& file, std::ostream& out)
+{
+  if (file.error.empty())
+  {
+    out << "OK     " << std::setw(10) << to_ms(file.duration) << "ms  " << file.path << "\n";
+  }
+  else
+  {
+    out << "ERROR  " << std::setw(10) << to_ms(file.duration) << "ms  " << file.path << ": " << file.error << "\n";
+  }
+}
+
+std::size_t check_midi_files(const std::vector<std::string>& paths, std::ostream& out)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<struct checked_file> files;
+  visited_directories visited;
+  for (const auto& path : paths)
+  {
+    find_files(path, true, visited, files);
+  }
+
+  // the biggest files first, so that a big file checked last doesn't keep
+  // all the other cores waiting.
+  std::vector<std::size_t> order (files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&] (std::size_t a, std::size_t b) {
+      return files[a].size > files[b].size;
+    });
+
+  // the verdicts are printed in the order the files were given, as soon as
+  // the ones before are known: a long check shows its progress, and what
+  // was checked isn't lost if it is interrupted.
+  std::mutex print_mutex; // protects what follows, and out
+  std::vector<bool> is_checked (files.size(), false);
+  std::size_t nb_printed = 0;
+  std::size_t nb_invalid = 0;
+
+  out << std::fixed << std::setprecision(3);
+  parallel_for(files.size(), [&] (std::size_t i) {
+      auto& file = files[order[i]];
+      if (file.error.empty())
+      {
+	check_file(file);
+      }
+
+      std::lock_guard<std::mutex> lock (print_mutex);
+      is_checked[order[i]] = true;
+
+      const auto first_to_print = nb_printed;
+      for (; (nb_printed < files.size()) and is_checked[nb_printed]; ++nb_printed)
+      {
+	if (not files[nb_printed].error.empty())
+	{
+	  nb_invalid++;
+	}
+	print_verdict(files[nb_printed], out);
+      }
+
+      if (nb_printed != first_to_print)
+      {
+	out.flush();
+      }
+    });
+
+  out << files.size() << " files checked, " << nb_invalid << " invalid, in "
+      << to_ms(std::chrono::steady_clock::now() - start) << "ms\n";
+
+  return nb_invalid;
+}
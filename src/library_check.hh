@@ -0,0 +1,18 @@
+#ifndef LIBRARY_CHECK_HH_
+#define LIBRARY_CHECK_HH_
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// validates midi files with the same checks as when they are played, without
+// playing them. Directories are searched recursively for .mid and .midi
+// files, each directory once even if symbolic links lead to it again. The
+// files are checked in parallel, one per core.
+//
+// Prints a verdict and the checking time of each file, in the order they
+// were given, as soon as it and the ones before are known, then a summary.
+// Returns the number of invalid files.
+std::size_t check_midi_files(const std::vector<std::string>& paths, std::ostream& out);
+
+#endif /* LIBRARY_CHECK_HH_ */
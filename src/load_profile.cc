@@ -0,0 +1,195 @@
+#include <iomanip>
+#include <cstdio> // for snprintf
+
+#include "load_profile.hh"
+#include "allocation_stats.hh"
+#include "midi_reader.hh"
+#include "keyboard_events_extractor.hh"
+#include "utils.hh"
+#include "song_cache.hh"
+#include "song_loader.hh"
+
+// measures a stage, from its construction to the call to stop()
+class stage_measure
+{
+  public:
+    explicit stage_measure(const std::string& init_name)
+      : name (init_name)
+      , start_stats ()
+      , start_time ()
+    {
+      reset_peak_bytes();
+      start_stats = get_allocation_stats();
+      start_time = std::chrono::steady_clock::now();
+    }
+
+    struct stage_profile stop() const
+    {
+      const auto end_time = std::chrono::steady_clock::now();
+      const auto end_stats = get_allocation_stats();
+
+      struct stage_profile res;
+      res.name = name;
+      res.wall_time = end_time - start_time;
+      res.nb_allocations = end_stats.nb_allocations - start_stats.nb_allocations;
+      res.peak_bytes = (end_stats.peak_bytes > start_stats.current_bytes) ? end_stats.peak_bytes - start_stats.current_bytes : 0;
+      return res;
+    }
+
+  private:
+    std::string name;
+    struct allocation_stats start_stats;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+struct load_profile profile_load(const std::string& filename)
+{
+  struct load_profile res;
+  res.filename = filename;
+
+  {
+    stage_measure midi_events_stage ("midi_events");
+    class tempo_map tempo;
+    const auto midi_events = get_midi_events(filename, tempo);
+    res.stages.push_back(midi_events_stage.stop());
+
+    stage_measure key_events_stage ("key_events");
+    const auto key_events = get_key_events(midi_events, tempo);
+    res.stages.push_back(key_events_stage.stop());
+
+    stage_measure grouping_stage ("grouping");
+    const auto music = group_events_by_time(midi_events, key_events, tempo);
+    res.stages.push_back(grouping_stage.stop());
+
+    res.nb_midi_events = midi_events.size();
+    res.nb_key_events = key_events.size();
+    res.nb_music_events = music.events.size();
+  }
+
+  // what the player actually does, the song being appended piece after
+  // piece. The whole song stage includes the first piece one.
+  stage_measure whole_song_stage ("stream_whole_song");
+  stage_measure first_piece_stage ("stream_first_piece");
+
+  song_loader loader (filename, song_cache(""));
+  struct song music;
+  struct song piece;
+  bool is_first_piece = true;
+  for (;;)
+  {
+    if (loader.next_piece(piece, std::chrono::milliseconds{ 100 }))
+    {
+      if (is_first_piece)
+      {
+	res.stages.push_back(first_piece_stage.stop());
+	is_first_piece = false;
+      }
+      append_song(music, piece);
+    }
+    else if (loader.is_done())
+    {
+      break;
+    }
+  }
+  res.stages.push_back(whole_song_stage.stop());
+
+  return res;
+}
+
+static double to_ms(std::chrono::nanoseconds duration)
+{
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void print_profile(const struct load_profile& profile, std::ostream& out)
+{
+  out << profile.filename << ": "
+      << profile.nb_midi_events << " midi events, "
+      << profile.nb_key_events << " key events, "
+      << profile.nb_music_events << " music events\n";
+
+  out << std::left << std::setw(20) << "stage"
+      << std::right << std::setw(14) << "wall time"
+      << std::setw(14) << "allocations"
+      << std::setw(16) << "peak bytes" << "\n";
+
+  out << std::fixed << std::setprecision(3);
+  for (const auto& stage : profile.stages)
+  {
+    out << std::left << std::setw(20) << stage.name
+	<< std::right << std::setw(12) << to_ms(stage.wall_time) << "ms";
+    if (are_allocations_counted())
+    {
+      out << std::setw(14) << stage.nb_allocations
+	  << std::setw(16) << stage.peak_bytes << "\n";
+    }
+    else
+    {
+      out << std::setw(14) << "-"
+	  << std::setw(16) << "-" << "\n";
+    }
+  }
+
+  if (not are_allocations_counted())
+  {
+    out << "(the allocations are only counted by the builds made with COUNT_ALLOCATIONS=1)\n";
+  }
+}
+
+static std::string json_string(const std::string& s)
+{
+  std::string res = "\"";
+  for (const char c : s)
+  {
+    switch (c)
+    {
+      case '"':  res += "\\\""; break;
+      case '\\': res += "\\\\"; break;
+      case '\n': res += "\\n"; break;
+      case '\t': res += "\\t"; break;
+      default:
+	if (static_cast<unsigned char>(c) < 0x20)
+	{
+	  char escaped[7];
+	  std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+	  res += escaped;
+	}
+	else
+	{
+	  res += c;
+	}
+	break;
+    }
+  }
+  return res + "\"";
+}
+
+void print_profile_json(const struct load_profile& profile, std::ostream& out)
+{
+  out << "{\n"
+      << "  \"file\": " << json_string(profile.filename) << ",\n"
+      << "  \"midi_events\": " << profile.nb_midi_events << ",\n"
+      << "  \"key_events\": " << profile.nb_key_events << ",\n"
+      << "  \"music_events\": " << profile.nb_music_events << ",\n"
+      << "  \"stages\": [";
+
+  for (auto i = decltype(profile.stages.size()){0}; i < profile.stages.size(); ++i)
+  {
+    const auto& stage = profile.stages[i];
+    out << ((i == 0) ? "\n" : ",\n")
+	<< "    { \"name\": " << json_string(stage.name)
+	<< ", \"wall_time_ns\": " << stage.wall_time.count();
+    if (are_allocations_counted())
+    {
+      out << ", \"allocations\": " << stage.nb_allocations
+	  << ", \"peak_bytes\": " << stage.peak_bytes << " }";
+    }
+    else
+    {
+      out << ", \"allocations\": null, \"peak_bytes\": null }";
+    }
+  }
+
+  out << "\n  ]\n"
+      << "}\n";
+}
@@ -0,0 +1,53 @@
+#ifndef LOAD_PROFILE_HH_
+#define LOAD_PROFILE_HH_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+struct stage_profile
+{
+    std::string name;
+    std::chrono::nanoseconds wall_time;
+    uint64_t nb_allocations;
+    std::size_t peak_bytes; // the most memory allocated at once, on top of what was before the stage
+
+    stage_profile()
+      : name ()
+      , wall_time (0)
+      , nb_allocations (0)
+      , peak_bytes (0)
+    {
+    }
+};
+
+// where the time and memory go when loading a song
+struct load_profile
+{
+    std::string filename;
+    std::vector<struct stage_profile> stages;
+    std::size_t nb_midi_events;
+    std::size_t nb_key_events;
+    std::size_t nb_music_events;
+
+    load_profile()
+      : filename ()
+      , stages ()
+      , nb_midi_events (0)
+      , nb_key_events (0)
+      , nb_music_events (0)
+    {
+    }
+};
+
+// loads the song, one stage after the other, then the way the player does
+// it (streamed, without the cache), measuring each of them.
+struct load_profile profile_load(const std::string& filename);
+
+void print_profile(const struct load_profile& profile, std::ostream& out);
+void print_profile_json(const struct load_profile& profile, std::ostream& out);
+
+#endif /* LOAD_PROFILE_HH_ */
@@ -1,36 +1,132 @@
 #include <iostream>
 #include <string>
+#include <vector>
+#include <stdexcept>
+#include <limits>
+#include <chrono>
+#include <cmath>
 
 #include "midi_reader.hh"
 #include "keyboard_events_extractor.hh"
 #include "utils.hh"
+#include "song_cache.hh"
+#include "song_loader.hh"
 #include "music_player.hh"
+#include "library_check.hh"
+#include "load_profile.hh"
 #include "signals_handler.hh"
+#include "midi_output.hh"
 
 struct options
 {
     bool has_error;
     bool print_help;
     bool list_ports;
-    unsigned int output_port;
+    std::string output_port; // resolved by the backend
     bool was_output_port_set;
+    enum output_backend backend;
+    bool was_backend_set;
     unsigned int input_port;
     bool was_input_port_set;
-    std::string filename;
+    bool realtime;
+    bool use_cache;
+    bool check;
+    bool profile;
+    bool profile_json;
+    bool bench;
+    bool print_timing;
+    std::string timing_csv;
+    unsigned int fps;
+    std::chrono::nanoseconds start_at;
+    std::vector<std::string> filenames;
 
     options()
       : has_error (false)
       , print_help (false)
       , list_ports (false)
-      , output_port (0)
+      , output_port ()
       , was_output_port_set(false)
+      , backend (output_backend::rtmidi)
+      , was_backend_set (false)
       , input_port (0)
       , was_input_port_set(false)
-      , filename ("")
+      , realtime (false)
+      , use_cache (true)
+      , check (false)
+      , profile (false)
+      , profile_json (false)
+      , bench (false)
+      , print_timing (false)
+      , timing_csv ()
+      , fps (60)
+      , start_at (0)
+      , filenames ()
     {
     }
 };
 
+// returns false if the string is not a strictly positive number
+static bool get_positive_number(const std::string& s, unsigned int& res)
+{
+  try
+  {
+    std::size_t nb_parsed = 0;
+    const auto value = std::stoul(s, &nb_parsed);
+    if ((nb_parsed != s.size()) or (value == 0) or (value > std::numeric_limits<unsigned int>::max()))
+    {
+      return false;
+    }
+
+    res = static_cast<unsigned int>(value);
+    return true;
+  }
+  catch (std::logic_error&) // std::invalid_argument or std::out_of_range
+  {
+    return false;
+  }
+}
+
+// reads a song time written as [[hours:]minutes:]seconds, the seconds
+// possibly having a fractional part. Returns false if the string is not
+// such a time.
+static bool get_song_time(const std::string& s, std::chrono::nanoseconds& res)
+{
+  try
+  {
+    std::chrono::duration<double> total { 0 };
+    std::size_t pos = 0;
+    unsigned int nb_fields = 0;
+
+    for (;;)
+    {
+      const auto end = s.find(':', pos);
+      const auto field = s.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+
+      std::size_t nb_parsed = 0;
+      const auto value = std::stod(field, &nb_parsed);
+      if ((nb_parsed != field.size()) or (not std::isfinite(value)) or (value < 0.0) or (++nb_fields > 3))
+      {
+	return false;
+      }
+
+      total = total * 60 + std::chrono::duration<double>{ value };
+
+      if (end == std::string::npos)
+      {
+	break;
+      }
+      pos = end + 1;
+    }
+
+    res = std::chrono::duration_cast<std::chrono::nanoseconds>(total);
+    return true;
+  }
+  catch (std::logic_error&) // std::invalid_argument or std::out_of_range
+  {
+    return false;
+  }
+}
+
 static
 struct options get_opts(const int argc, const char * const * const argv)
 {
@@ -61,12 +157,24 @@ struct options get_opts(const int argc, const char * const * const argv)
       else
       {
 	++i;
-	res.output_port = get_port(argv[i]);
+	res.output_port = argv[i];
 	res.was_output_port_set = true;
       }
       continue;
     }
 
+    if ((arg == "-b") or (arg == "--backend"))
+    {
+      if ((i == argc - 1) or (not get_output_backend(argv[i + 1], res.backend)))
+      {
+	res.has_error = true;
+	return res;
+      }
+      ++i;
+      res.was_backend_set = true;
+      continue;
+    }
+
     if ((arg == "-i") or (arg == "--input-port"))
     {
       if (i == argc - 1)
@@ -83,15 +191,89 @@ struct options get_opts(const int argc, const char * const * const argv)
       continue;
     }
 
-    if (res.filename != "")
+    if (arg == "--fps")
     {
-      res.has_error = true;
-      return res;
+      if ((i == argc - 1) or (not get_positive_number(argv[i + 1], res.fps)))
+      {
+	res.has_error = true;
+	return res;
+      }
+      ++i;
+      continue;
     }
-    else
+
+    if (arg == "--start-at")
     {
-      res.filename = argv[i];
+      if ((i == argc - 1) or (not get_song_time(argv[i + 1], res.start_at)))
+      {
+	res.has_error = true;
+	return res;
+      }
+      ++i;
+      continue;
     }
+
+    if (arg == "--bench")
+    {
+      res.bench = true;
+      continue;
+    }
+
+    if (arg == "--timing")
+    {
+      res.print_timing = true;
+      continue;
+    }
+
+    if (arg == "--timing-csv")
+    {
+      if (i == argc - 1)
+      {
+	res.has_error = true;
+	return res;
+      }
+      ++i;
+      res.timing_csv = argv[i];
+      continue;
+    }
+
+    if (arg == "--realtime")
+    {
+      res.realtime = true;
+      continue;
+    }
+
+    if (arg == "--no-cache")
+    {
+      res.use_cache = false;
+      continue;
+    }
+
+    if (arg == "--check")
+    {
+      res.check = true;
+      continue;
+    }
+
+    if (arg == "--profile")
+    {
+      res.profile = true;
+      continue;
+    }
+
+    if (arg == "--profile-json")
+    {
+      res.profile_json = true;
+      continue;
+    }
+
+    res.filenames.push_back(argv[i]);
+  }
+
+  // only --check takes several files
+  if ((res.filenames.size() > 1) and (not res.check))
+  {
+    res.has_error = true;
   }
 
   return res;
@@ -100,20 +282,44 @@ struct options get_opts(const int argc, const char * const * const argv)
 static void usage(std::ostream& out, const std::string& progname)
 {
   out << "Usage: " << progname << " [Options] [File]\n"
+      "       " << progname << " --check <File|Directory>...\n"
+      "\n"
+      "The midi file is read from the standard input if File is -. A single track\n"
+      "file read from a pipe is played as it arrives.\n"
       "\n"
       "Options:\n"
       "  -h, --help			print this help\n"
       "  -l, --list			list the midi output ports available for use\n"
-      "  -o, --output-port <NUM>	the output midi port to use\n"
-      "  -i, --input-port <NUM>	the input midi to use if no file is provided\n";
+      "  -o, --output-port <PORT>	the output midi port to use: its number or name with\n"
+      "				rtmidi, its client:port address or client name with\n"
+      "				alsa, or the midi file to write with file\n"
+      "  -b, --backend <NAME>		what to send the midi messages through: rtmidi\n"
+      "				(default), alsa (the ALSA sequencer, timestamped\n"
+      "				on a queue), file (record to a midi file) or null\n"
+      "				(nowhere)\n"
+      "  -i, --input-port <NUM>	the input midi to use if no file is provided\n"
+      "  --fps <NUM>			maximum number of frames drawn per second (default 60)\n"
+      "  --start-at <TIME>		start playing at [[hours:]minutes:]seconds in the song\n"
+      "  --realtime			play with a real-time priority (needs the right privileges)\n"
+      "  --timing			print how late the notes were played at exit, or the\n"
+      "				latency added to the midi input in live mode\n"
+      "  --timing-csv <FILE>		write when each note was due and played to FILE\n"
+      "  --no-cache			neither use nor fill the cache of decoded songs\n"
+      "  --check			only check that the files are valid, directories are\n"
+      "				searched for .mid and .midi files\n"
+      "  --profile			only load the file, and report the time and memory\n"
+      "				used by each stage (the memory needs a build made\n"
+      "				with COUNT_ALLOCATIONS=1)\n"
+      "  --profile-json		same as --profile, with the report written in JSON\n"
+      "  --bench			play the file as fast as possible, without display,\n"
+      "				and report the throughput of the player. Without\n"
+      "				sound, unless a backend is given\n";
 }
 
 
 
 int main(const int argc, const char* const * const argv)
 {
-  set_signal_handler();
-
   const auto opts = get_opts(argc, argv);
 
   const std::string prog_name = argv[0];
@@ -136,40 +342,125 @@ int main(const int argc, const char* const * const argv)
     return 0;
   }
 
-  if (not opts.was_output_port_set)
+  if (opts.check)
+  {
+    if (opts.filenames.empty())
+    {
+      usage(std::cerr, prog_name);
+      return 2;
+    }
+
+    return (check_midi_files(opts.filenames, std::cout) == 0) ? 0 : 1;
+  }
+
+  if (opts.profile or opts.profile_json)
   {
-    std::cerr << "Error: the midi output port must be set from command line\n\n";
+    if (opts.filenames.size() != 1)
+    {
+      usage(std::cerr, prog_name);
+      return 2;
+    }
+
+    try
+    {
+      const auto profile = profile_load(opts.filenames.front());
+      if (opts.profile_json)
+      {
+	print_profile_json(profile, std::cout);
+      }
+      else
+      {
+	print_profile(profile, std::cout);
+      }
+      return 0;
+    }
+    catch (std::exception& e)
+    {
+      std::cerr << e.what() << "\n";
+      return 2;
+    }
+  }
+
+  if (opts.bench)
+  {
+    if (opts.filenames.size() != 1)
+    {
+      usage(std::cerr, prog_name);
+      return 2;
+    }
+
+    try
+    {
+      const song_cache cache = opts.use_cache ? song_cache() : song_cache("");
+      song_loader loader (opts.filenames.front(), cache);
+
+      // nothing is sent anywhere unless asked for, to time the player alone
+      const auto output = make_midi_output(opts.was_backend_set ? opts.backend : output_backend::null, opts.output_port);
+
+      struct player_options player_opts;
+      player_opts.fps = opts.fps;
+      player_opts.start_at = opts.start_at;
+
+      print_bench_result(bench(loader, *output, player_opts), std::cout);
+      return 0;
+    }
+    catch (std::exception& e)
+    {
+      std::cerr << e.what() << "\n";
+      return 2;
+    }
+  }
+
+  const std::string filename = opts.filenames.empty() ? "" : opts.filenames.front();
+
+  if ((not opts.was_output_port_set) and (opts.backend != output_backend::null))
+  {
+    std::cerr << "Error: the midi output port (or file) must be set from command line\n\n";
     usage(std::cerr, prog_name);
     return 2;
   }
 
-  if ((opts.filename == "") and (not opts.was_input_port_set))
+  if ((filename == "") and (not opts.was_input_port_set))
   {
     usage(std::cerr, prog_name);
     return 2;
   }
 
-  if ((opts.filename != "") and (opts.was_input_port_set))
+  if ((filename != "") and (opts.was_input_port_set))
   {
     std::cerr << "Error: can't use a midi file and a midi input port simultaneously\n\n";
     usage(std::cerr, prog_name);
     return 2;
   }
 
+  // from here, the signals are only read by the event loop of the player,
+  // even the ones received while the beginning of the song is loaded. They
+  // are blocked before any thread exists, so that all of them inherit it.
+  block_handled_signals();
 
   try
   {
-    if (opts.filename != "")
-    {
-      const auto midi_events = get_midi_events(opts.filename);
-      const auto keyboard_events = get_key_events(midi_events);
-      const auto song = group_events_by_time(midi_events, keyboard_events);
+    struct player_options player_opts;
+    player_opts.realtime = opts.realtime;
+    player_opts.fps = opts.fps;
+    player_opts.start_at = opts.start_at;
+    player_opts.print_timing = opts.print_timing;
+    player_opts.timing_csv = opts.timing_csv;
 
-      play(song, opts.output_port);
+    // outlives the player: a midi file is written once everything was sent
+    const auto output = make_midi_output(opts.backend, opts.output_port);
+
+    if (filename != "")
+    {
+      // the header is checked right away, the rest of the file is read
+      // while the song starts playing.
+      const song_cache cache = opts.use_cache ? song_cache() : song_cache("");
+      song_loader loader (filename, cache);
+      play(loader, *output, player_opts);
     }
     else
     {
-      play(opts.input_port, opts.output_port);
+      play(opts.input_port, *output, player_opts);
     }
   }
   catch (std::exception& e)
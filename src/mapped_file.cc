@@ -0,0 +1,207 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include <algorithm>
+
+#include "mapped_file.hh"
+
+static struct file_identity identity_of(const struct stat& file_info)
+{
+  struct file_identity res;
+  res.device = static_cast<uint64_t>(file_info.st_dev);
+  res.inode = static_cast<uint64_t>(file_info.st_ino);
+  res.size = static_cast<uint64_t>(file_info.st_size);
+  res.modification_time = static_cast<int64_t>(file_info.st_mtim.tv_sec) * 1000000000 + file_info.st_mtim.tv_nsec;
+  return res;
+}
+
+bool identify_file(const std::string& filename, struct file_identity& res)
+{
+  struct stat file_info;
+  if ((stat(filename.c_str(), &file_info) == -1) or (not S_ISREG(file_info.st_mode)))
+  {
+    return false;
+  }
+
+  res = identity_of(file_info);
+  return true;
+}
+
+mapped_file::mapped_file(const std::string& filename, bool is_read_progressively)
+  : data (nullptr)
+  , length (0)
+  , opened (false)
+  , is_mapped (false)
+  , is_regular (false)
+  , id ()
+  , buffer ()
+  , pending_fd (-1)
+  , is_pending_fd_owned (false)
+  , has_read_failed (false)
+{
+  if (filename == "-")
+  {
+    read_progressively(STDIN_FILENO, false);
+    if (not is_read_progressively)
+    {
+      read_whole();
+    }
+    return;
+  }
+
+  const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    return;
+  }
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) == -1)
+  {
+    close(fd);
+    return;
+  }
+
+  if (S_ISFIFO(file_info.st_mode) or S_ISCHR(file_info.st_mode) or S_ISSOCK(file_info.st_mode))
+  {
+    read_progressively(fd, true);
+    if (not is_read_progressively)
+    {
+      read_whole();
+    }
+    return;
+  }
+
+  if (not S_ISREG(file_info.st_mode))
+  {
+    close(fd);
+    return;
+  }
+
+  is_regular = true;
+  id = identity_of(file_info);
+
+  const auto file_size = static_cast<std::size_t>(file_info.st_size);
+  if (file_size == 0)
+  {
+    // mmap refuses empty mappings. An empty file is still a valid (empty) view.
+    close(fd);
+    opened = true;
+    return;
+  }
+
+  void* const mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // the mapping holds its own reference on the file, the descriptor is no
+  // longer needed whatever the outcome.
+  close(fd);
+
+  if (mapping == MAP_FAILED)
+  {
+    return;
+  }
+
+  // the whole file is going to be read, let the kernel read ahead.
+  madvise(mapping, file_size, MADV_WILLNEED);
+
+  data = static_cast<const uint8_t*>(mapping);
+  length = file_size;
+  opened = true;
+  is_mapped = true;
+}
+
+// the file is opened, but its bytes are only read by read_more. Its size
+// isn't known in advance, the buffer grows as they come.
+void mapped_file::read_progressively(int fd, bool is_fd_owned)
+{
+  pending_fd = fd;
+  is_pending_fd_owned = is_fd_owned;
+  opened = true;
+}
+
+void mapped_file::read_whole()
+{
+  while (read_more())
+  {
+  }
+
+  // as if the file couldn't be opened
+  if (has_read_failed)
+  {
+    buffer.clear();
+    length = 0;
+    opened = false;
+  }
+
+  buffer.resize(length);
+  buffer.shrink_to_fit();
+  data = buffer.data();
+}
+
+bool mapped_file::read_more()
+{
+  constexpr const std::size_t min_read_size = 64 * 1024;
+
+  if (is_complete())
+  {
+    return false;
+  }
+
+  if (buffer.size() - length < min_read_size)
+  {
+    buffer.resize(std::max(2 * buffer.size(), length + min_read_size));
+    data = buffer.data();
+  }
+
+  auto nb_read = read(pending_fd, buffer.data() + length, buffer.size() - length);
+  while ((nb_read == -1) and (errno == EINTR))
+  {
+    nb_read = read(pending_fd, buffer.data() + length, buffer.size() - length);
+  }
+
+  if (nb_read <= 0)
+  {
+    has_read_failed = (nb_read == -1);
+    finish_reading();
+    return false;
+  }
+
+  length += static_cast<std::size_t>(nb_read);
+  return true;
+}
+
+void mapped_file::finish_reading()
+{
+  if (is_pending_fd_owned)
+  {
+    close(pending_fd);
+  }
+  pending_fd = -1;
+}
+
+bool mapped_file::identify(struct file_identity& res) const
+{
+  if (not is_regular)
+  {
+    return false;
+  }
+
+  res = id;
+  return true;
+}
+
+mapped_file::~mapped_file()
+{
+  if (is_pending_fd_owned and (pending_fd != -1))
+  {
+    close(pending_fd);
+  }
+
+  if (is_mapped)
+  {
+    munmap(const_cast<uint8_t*>(data), length);
+  }
+}
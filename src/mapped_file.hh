@@ -0,0 +1,95 @@
+#ifndef MAPPED_FILE_HH_
+#define MAPPED_FILE_HH_
+
+#include <string>
+#include <vector>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+// what tells a regular file apart from the others, and from its own previous
+// versions: it changes whenever the file is replaced or written to.
+struct file_identity
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t modification_time; // in nanoseconds since the epoch
+};
+
+// returns false if the file can't be found, or is not a regular file
+bool identify_file(const std::string& filename, struct file_identity& res);
+
+// read-only view of a whole file, mapped in memory.
+// The files which can't be mapped, like pipes, or the standard input when the
+// filename is "-", are read into memory instead, up to their end. Unless
+// they are read progressively: their bytes are then only read when
+// read_more is called, so that they can be used as they come.
+// Like std::fstream, failing to open the file is not an error by itself, the
+// caller is expected to check is_open().
+class mapped_file
+{
+  public:
+    explicit mapped_file(const std::string& filename, bool is_read_progressively = false);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool is_open() const
+    {
+      return opened;
+    }
+
+    const uint8_t* begin() const
+    {
+      return data;
+    }
+
+    const uint8_t* end() const
+    {
+      return data + length;
+    }
+
+    std::size_t size() const
+    {
+      return length;
+    }
+
+    // returns false if what was opened is not a regular file (a pipe, the
+    // standard input...), which nothing tells apart from another one.
+    bool identify(struct file_identity& res) const;
+
+    // false while the file is read progressively, until its end is reached
+    bool is_complete() const
+    {
+      return pending_fd == -1;
+    }
+
+    // appends the next bytes of a file read progressively, waiting for them
+    // if needed. Returns false, and appends nothing, once its end is reached.
+    // A read error ends the file there too.
+    //
+    // The bytes may be moved: the pointers given by begin() and end() are
+    // invalidated by each call.
+    bool read_more();
+
+  private:
+    void read_progressively(int fd, bool is_fd_owned);
+    void read_whole();
+    void finish_reading();
+
+    const uint8_t* data;
+    std::size_t length;
+    bool opened;
+    bool is_mapped;
+    bool is_regular;
+    struct file_identity id; // of the file opened, when it is a regular one
+    std::vector<uint8_t> buffer; // the content, when it is not mapped
+
+    // the descriptor of a file read progressively, until its end is reached
+    int pending_fd;
+    bool is_pending_fd_owned;
+    bool has_read_failed;
+};
+
+#endif /* MAPPED_FILE_HH_ */
@@ -0,0 +1,493 @@
+// generates synthetic standard midi files, to benchmark pianoterm on songs
+// of any size. The same options and seed always give the same file.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <tuple>
+#include <cstdint>
+
+struct corpus_options
+{
+    uint64_t nb_notes; // over all the tracks
+    unsigned int nb_tracks; // not counting the tempo track
+    unsigned int density; // notes per second, over all the tracks
+    unsigned int polyphony; // at most that many notes started at once on a track
+    unsigned int tempo_change_period; // in beats, 0 for a constant tempo
+    bool running_status;
+    unsigned int sysex_size; // bytes of the sysex message at the start of each track, 0 for none
+    uint64_t seed;
+    std::string output; // standard output if empty
+
+    corpus_options()
+      : nb_notes (10000)
+      , nb_tracks (16)
+      , density (100)
+      , polyphony (4)
+      , tempo_change_period (0)
+      , running_status (true)
+      , sysex_size (0)
+      , seed (1)
+      , output ()
+    {
+    }
+};
+
+// splitmix64: unlike the distributions of <random>, it gives the same
+// numbers with every standard library.
+class random_generator
+{
+  public:
+    explicit random_generator(uint64_t seed)
+      : state (seed)
+    {
+    }
+
+    uint64_t next()
+    {
+      state += UINT64_C(0x9E3779B97F4A7C15);
+      auto z = state;
+      z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+      z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+      return z ^ (z >> 31);
+    }
+
+    // in [min, max]
+    uint32_t between(uint32_t min, uint32_t max)
+    {
+      return min + static_cast<uint32_t>(next() % (uint64_t{ max } - min + 1));
+    }
+
+  private:
+    uint64_t state;
+};
+
+constexpr const uint16_t ticks_per_quarter = 480;
+constexpr const uint8_t lowest_pitch = 21; // la 0
+constexpr const uint8_t highest_pitch = 108; // do 8
+
+// the bytes of a track chunk, written as the events come
+class track_writer
+{
+  public:
+    explicit track_writer(bool init_running_status)
+      : data ()
+      , current_tick (0)
+      , running_status (init_running_status)
+      , last_status (0)
+    {
+    }
+
+    void channel_message(uint64_t tick, uint8_t status, uint8_t data1, uint8_t data2)
+    {
+      delta_time(tick);
+      if ((not running_status) or (status != last_status))
+      {
+	data.push_back(status);
+      }
+      last_status = status;
+      data.push_back(data1);
+      data.push_back(data2);
+    }
+
+    void meta_event(uint64_t tick, uint8_t type, const std::vector<uint8_t>& bytes)
+    {
+      delta_time(tick);
+      data.push_back(0xFF);
+      data.push_back(type);
+      variable_length(bytes.size());
+      data.insert(data.end(), bytes.begin(), bytes.end());
+      last_status = 0; // meta events cancel the running status
+    }
+
+    void sysex_event(uint64_t tick, const std::vector<uint8_t>& bytes)
+    {
+      delta_time(tick);
+      data.push_back(0xF0);
+      variable_length(bytes.size() + 1);
+      data.insert(data.end(), bytes.begin(), bytes.end());
+      data.push_back(0xF7);
+      last_status = 0; // so do sysex events
+    }
+
+    // the track ends at end_tick, or after its last event
+    void write_chunk(std::ostream& out, uint64_t end_tick)
+    {
+      meta_event(std::max(end_tick, current_tick), 0x2F, {});
+
+      if (data.size() > std::numeric_limits<uint32_t>::max())
+      {
+	throw std::runtime_error("Error: a track can't be bigger than 4GiB, use more tracks");
+      }
+
+      out.write("MTrk", 4);
+      write_be(out, static_cast<uint32_t>(data.size()), 4);
+      out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+
+    static void write_be(std::ostream& out, uint64_t value, unsigned int nb_bytes)
+    {
+      for (unsigned int i = nb_bytes; i > 0; --i)
+      {
+	out.put(static_cast<char>((value >> (8 * (i - 1))) & 0xFF));
+      }
+    }
+
+  private:
+    void delta_time(uint64_t tick)
+    {
+      variable_length(tick - current_tick);
+      current_tick = tick;
+    }
+
+    void variable_length(uint64_t value)
+    {
+      if (value > 0x0FFFFFFF)
+      {
+	throw std::runtime_error("Error: a variable length quantity can't be bigger than 0x0FFFFFFF");
+      }
+
+      uint8_t bytes[4];
+      unsigned int nb_bytes = 0;
+      do
+      {
+	bytes[nb_bytes++] = static_cast<uint8_t>(value & 0x7F);
+	value >>= 7;
+      } while (value != 0);
+
+      while (nb_bytes > 1)
+      {
+	data.push_back(static_cast<uint8_t>(bytes[--nb_bytes] | 0x80));
+      }
+      data.push_back(bytes[0]);
+    }
+
+    std::vector<uint8_t> data;
+    uint64_t current_tick;
+    bool running_status;
+    uint8_t last_status;
+};
+
+// the conductor track: the time signature, and the tempo changes
+static void write_tempo_track(std::ostream& out, const struct corpus_options& options, uint64_t end_tick, random_generator& random)
+{
+  track_writer track (options.running_status);
+  track.meta_event(0, 0x58, { 4, 2, 24, 8 }); // 4/4
+
+  const auto set_tempo = [&] (uint64_t tick, uint32_t bpm) {
+    const uint32_t us_per_quarter = 60000000 / bpm;
+    track.meta_event(tick, 0x51, { static_cast<uint8_t>(us_per_quarter >> 16),
+				   static_cast<uint8_t>(us_per_quarter >> 8),
+				   static_cast<uint8_t>(us_per_quarter) });
+  };
+
+  set_tempo(0, 120);
+  if (options.tempo_change_period != 0)
+  {
+    const uint64_t period = uint64_t{ options.tempo_change_period } * ticks_per_quarter;
+    for (auto tick = period; tick < end_tick; tick += period)
+    {
+      set_tempo(tick, random.between(60, 200));
+    }
+  }
+
+  track.write_chunk(out, end_tick);
+}
+
+// the notes of all the tracks are generated together, walking through the
+// song: a key can't be pressed on one track while it sounds on another, or
+// be pressed and released at the same tick, which pianoterm rejects. The
+// tracks are written once complete.
+static void write_notes_tracks(std::ostream& out, const struct corpus_options& options,
+			       uint64_t end_tick, random_generator& random)
+{
+  std::vector<track_writer> tracks (options.nb_tracks, track_writer(options.running_status));
+  std::vector<uint64_t> nb_notes_left (options.nb_tracks);
+  for (unsigned int i = 0; i < options.nb_tracks; ++i)
+  {
+    nb_notes_left[i] = options.nb_notes / options.nb_tracks + ((i < options.nb_notes % options.nb_tracks) ? 1 : 0);
+  }
+
+  if (options.sysex_size != 0)
+  {
+    for (auto& track : tracks)
+    {
+      std::vector<uint8_t> bytes (options.sysex_size);
+      bytes[0] = 0x7D; // non-commercial manufacturer id
+      for (std::size_t i = 1; i < bytes.size(); ++i)
+      {
+	bytes[i] = static_cast<uint8_t>(random.next() & 0x7F);
+      }
+      track.sysex_event(0, bytes);
+    }
+  }
+
+  // the chords are evenly spread over the song, on average
+  const auto average_chord_size = (options.polyphony + 1) / 2.0;
+  const auto nb_chords = static_cast<double>(options.nb_notes) / average_chord_size;
+  const auto average_gap = static_cast<uint32_t>(std::max(1.0, static_cast<double>(end_tick) / std::max(nb_chords, 1.0)));
+
+  struct note_off
+  {
+      uint64_t tick;
+      uint8_t pitch;
+      unsigned int track;
+
+      bool operator>(const note_off& other) const
+      {
+	return std::tie(tick, pitch, track) > std::tie(other.tick, other.pitch, other.track);
+      }
+  };
+  std::priority_queue<note_off, std::vector<note_off>, std::greater<note_off>> note_offs;
+
+  // the first tick a key can be pressed at, over all the tracks: the one
+  // after it was last released.
+  std::array<uint64_t, 128> free_from {};
+  std::array<bool, 128> is_sounding {};
+
+  const auto release_until = [&] (uint64_t tick) {
+    while ((not note_offs.empty()) and (note_offs.top().tick <= tick))
+    {
+      const auto off = note_offs.top();
+      note_offs.pop();
+
+      const auto channel = static_cast<uint8_t>(off.track % 16);
+      // a note on of velocity 0 keeps the running status going
+      if (options.running_status)
+      {
+	tracks[off.track].channel_message(off.tick, static_cast<uint8_t>(0x90 | channel), off.pitch, 0);
+      }
+      else
+      {
+	tracks[off.track].channel_message(off.tick, static_cast<uint8_t>(0x80 | channel), off.pitch, 64);
+      }
+      is_sounding[off.pitch] = false;
+      free_from[off.pitch] = off.tick + 1;
+    }
+  };
+
+  const auto is_free = [&] (uint8_t pitch, uint64_t tick) {
+    return (not is_sounding[pitch]) and (tick >= free_from[pitch]);
+  };
+
+  uint64_t tick = 0;
+  uint64_t nb_left = options.nb_notes;
+  while (nb_left != 0)
+  {
+    tick += random.between(0, 2 * average_gap);
+    release_until(tick);
+
+    // a track with notes left
+    auto track_index = random.between(0, options.nb_tracks - 1);
+    while (nb_notes_left[track_index] == 0)
+    {
+      track_index = (track_index + 1) % options.nb_tracks;
+    }
+    const auto channel = static_cast<uint8_t>(track_index % 16);
+
+    const auto chord_size = random.between(1, options.polyphony);
+    for (uint32_t i = 0; (i < chord_size) and (nb_notes_left[track_index] != 0); ++i)
+    {
+      // the first free key from a random one: when every key is taken, the
+      // note is played later instead.
+      const auto first = random.between(lowest_pitch, highest_pitch);
+      auto pitch = static_cast<uint8_t>(first);
+      while (not is_free(pitch, tick))
+      {
+	pitch = (pitch == highest_pitch) ? lowest_pitch : static_cast<uint8_t>(pitch + 1);
+	if (pitch == first)
+	{
+	  break;
+	}
+      }
+      if (not is_free(pitch, tick))
+      {
+	break;
+      }
+
+      is_sounding[pitch] = true;
+      tracks[track_index].channel_message(tick, static_cast<uint8_t>(0x90 | channel), pitch, static_cast<uint8_t>(random.between(1, 127)));
+      note_offs.push({ tick + random.between(1, 2 * average_gap), pitch, track_index });
+      --nb_notes_left[track_index];
+      --nb_left;
+    }
+  }
+
+  release_until(std::numeric_limits<uint64_t>::max());
+
+  for (auto& track : tracks)
+  {
+    track.write_chunk(out, end_tick);
+  }
+}
+
+static void write_corpus_file(std::ostream& out, const struct corpus_options& options)
+{
+  out.write("MThd", 4);
+  track_writer::write_be(out, 6, 4);
+  track_writer::write_be(out, 1, 2); // format 1
+  track_writer::write_be(out, options.nb_tracks + 1, 2);
+  track_writer::write_be(out, ticks_per_quarter, 2);
+
+  // at 120 beats per minute, there are two quarters per second
+  const auto nb_seconds = std::max(uint64_t{ 1 }, options.nb_notes / options.density);
+  const auto end_tick = nb_seconds * 2 * ticks_per_quarter;
+
+  random_generator random (options.seed);
+  write_tempo_track(out, options, end_tick, random);
+
+  write_notes_tracks(out, options, end_tick, random);
+}
+
+// returns false if the string is not a number within [min, max]
+static bool get_number(const std::string& s, uint64_t min, uint64_t max, uint64_t& res)
+{
+  try
+  {
+    std::size_t nb_parsed = 0;
+    const auto value = std::stoull(s, &nb_parsed);
+    if ((nb_parsed != s.size()) or (value < min) or (value > max))
+    {
+      return false;
+    }
+
+    res = value;
+    return true;
+  }
+  catch (std::logic_error&) // std::invalid_argument or std::out_of_range
+  {
+    return false;
+  }
+}
+
+static bool get_number(const std::string& s, unsigned int min, unsigned int max, unsigned int& res)
+{
+  uint64_t value;
+  if (not get_number(s, uint64_t{ min }, uint64_t{ max }, value))
+  {
+    return false;
+  }
+
+  res = static_cast<unsigned int>(value);
+  return true;
+}
+
+static void usage(std::ostream& out, const std::string& progname)
+{
+  out << "Usage: " << progname << " [Options]\n"
+      "\n"
+      "Writes a synthetic midi file made of random notes\n"
+      "\n"
+      "Options:\n"
+      "  -h, --help			print this help\n"
+      "  -o, --output <FILE>		write to FILE instead of the standard output\n"
+      "  --notes <NUM>			number of notes over all the tracks (default 10000)\n"
+      "  --tracks <NUM>		number of tracks holding notes, 1 to 65534 (default 16)\n"
+      "  --density <NUM>		notes per second over all the tracks (default 100)\n"
+      "  --polyphony <NUM>		most notes started at once on a track, 1 to 88 (default 4)\n"
+      "  --tempo-changes <NUM>		change the tempo every NUM beats (default 0, never)\n"
+      "  --no-running-status		write the status byte of every message\n"
+      "  --sysex <NUM>			add a sysex message of NUM bytes to each track (default 0)\n"
+      "  --seed <NUM>			seed of the random notes (default 1)\n";
+}
+
+int main(const int argc, const char* const * const argv)
+{
+  const std::string prog_name = argv[0];
+  struct corpus_options options;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    const bool has_value = (i + 1 < argc);
+    const std::string value = has_value ? argv[i + 1] : "";
+
+    bool is_valid = has_value;
+    if ((arg == "-h") or (arg == "--help"))
+    {
+      usage(std::cout, prog_name);
+      return 0;
+    }
+    else if (arg == "--no-running-status")
+    {
+      options.running_status = false;
+      continue;
+    }
+    else if ((arg == "-o") or (arg == "--output"))
+    {
+      options.output = value;
+    }
+    else if (arg == "--notes")
+    {
+      is_valid = is_valid and get_number(value, uint64_t{ 1 }, std::numeric_limits<uint64_t>::max(), options.nb_notes);
+    }
+    else if (arg == "--tracks")
+    {
+      is_valid = is_valid and get_number(value, 1u, 65534u, options.nb_tracks);
+    }
+    else if (arg == "--density")
+    {
+      is_valid = is_valid and get_number(value, 1u, std::numeric_limits<unsigned int>::max(), options.density);
+    }
+    else if (arg == "--polyphony")
+    {
+      is_valid = is_valid and get_number(value, 1u, 88u, options.polyphony);
+    }
+    else if (arg == "--tempo-changes")
+    {
+      is_valid = is_valid and get_number(value, 0u, std::numeric_limits<unsigned int>::max(), options.tempo_change_period);
+    }
+    else if (arg == "--sysex")
+    {
+      is_valid = is_valid and get_number(value, 0u, 0x0FFFFFFEu, options.sysex_size);
+    }
+    else if (arg == "--seed")
+    {
+      is_valid = is_valid and get_number(value, uint64_t{ 0 }, std::numeric_limits<uint64_t>::max(), options.seed);
+    }
+    else
+    {
+      is_valid = false;
+    }
+
+    if (not is_valid)
+    {
+      usage(std::cerr, prog_name);
+      return 2;
+    }
+    ++i;
+  }
+
+  try
+  {
+    if (options.output.empty())
+    {
+      write_corpus_file(std::cout, options);
+      std::cout.flush();
+      return std::cout ? 0 : 1;
+    }
+
+    std::ofstream out (options.output, std::ios::binary);
+    write_corpus_file(out, options);
+    out.close();
+    if (not out)
+    {
+      std::cerr << "Error: couldn't write " << options.output << "\n";
+      return 1;
+    }
+    return 0;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+}
@@ -0,0 +1,389 @@
+#include <rtmidi/RtMidi.h>
+#include <alsa/asoundlib.h>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "midi_output.hh"
+#include "playback_clock.hh"
+
+midi_output::~midi_output()
+{
+}
+
+void midi_output::send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time)
+{
+  for (const auto& message : messages)
+  {
+    send(message.begin(), message.size(), time);
+  }
+}
+
+rtmidi_output::rtmidi_output(unsigned int midi_port)
+  : port (new RtMidiOut(RtMidi::LINUX_ALSA))
+{
+  port->openPort(midi_port);
+
+  if (not port->isPortOpen())
+  {
+    throw std::runtime_error("Error while initialising the sound system: couldn't open output sound port");
+  }
+}
+
+rtmidi_output::~rtmidi_output()
+{
+  port->closePort();
+}
+
+void rtmidi_output::send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds /* time */)
+{
+  // straight from the bytes of the song, without going through a vector
+  port->sendMessage(bytes, size);
+}
+
+struct alsa_output::impl
+{
+    snd_seq_t* seq;
+    snd_midi_event_t* encoder; // turns the midi bytes into sequencer events
+    int port;
+    int queue;
+    std::chrono::nanoseconds origin; // CLOCK_MONOTONIC time at which the queue started
+
+    impl()
+      : seq (nullptr)
+      , encoder (nullptr)
+      , port (-1)
+      , queue (-1)
+      , origin (0)
+    {
+    }
+
+    impl(const impl&) = delete;
+    impl& operator=(const impl&) = delete;
+
+    ~impl()
+    {
+      if (seq == nullptr)
+      {
+	return;
+      }
+
+      if (queue >= 0)
+      {
+	// what was scheduled is let out before the queue goes away
+	snd_seq_drain_output(seq);
+	snd_seq_sync_output_queue(seq);
+	snd_seq_free_queue(seq, queue);
+      }
+
+      if (encoder != nullptr)
+      {
+	snd_midi_event_free(encoder);
+      }
+
+      snd_seq_close(seq);
+    }
+
+    // ALSA returns negative error codes
+    static void check(int ret, const std::string& what)
+    {
+      if (ret < 0)
+      {
+	throw std::runtime_error("Error: the ALSA sequencer failed to " + what + ": " + snd_strerror(ret));
+      }
+    }
+
+    // puts the message in the output buffer, to be sent by the next drain
+    void output(const uint8_t* bytes, std::size_t size, const snd_seq_real_time_t& time)
+    {
+      snd_midi_event_reset_encode(encoder);
+
+      snd_seq_event_t ev;
+      snd_seq_ev_clear(&ev);
+      const auto nb_encoded = snd_midi_event_encode(encoder, bytes, static_cast<long>(size), &ev);
+      if ((nb_encoded < 0) or (ev.type == SND_SEQ_EVENT_NONE))
+      {
+	return; // not a message the sequencer knows about, it can't be sent anyway
+      }
+
+      // what the snd_seq_ev_set_* macros do, without their implicit
+      // conversions: to the subscribers of the port, at an absolute real
+      // time of the queue.
+      ev.source.port = static_cast<unsigned char>(port);
+      ev.dest.client = SND_SEQ_ADDRESS_SUBSCRIBERS;
+      ev.dest.port = SND_SEQ_ADDRESS_UNKNOWN;
+      ev.flags = static_cast<unsigned char>((ev.flags & ~(SND_SEQ_TIME_STAMP_MASK | SND_SEQ_TIME_MODE_MASK)) |
+					    SND_SEQ_TIME_STAMP_REAL | SND_SEQ_TIME_MODE_ABS);
+      ev.time.time = time;
+      ev.queue = static_cast<unsigned char>(queue);
+
+      check(snd_seq_event_output(seq, &ev), "queue an event");
+    }
+
+    // the time of the queue at which the messages are due. The ones already
+    // late are delivered as soon as they reach the sequencer.
+    snd_seq_real_time_t queue_time_of(std::chrono::nanoseconds time) const
+    {
+      const auto since_origin = std::max(time - origin, std::chrono::nanoseconds{ 0 });
+      const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_origin);
+
+      snd_seq_real_time_t res;
+      res.tv_sec = static_cast<unsigned int>(seconds.count());
+      res.tv_nsec = static_cast<unsigned int>((since_origin - seconds).count());
+      return res;
+    }
+};
+
+alsa_output::alsa_output(const std::string& address)
+  : p (new impl())
+{
+  impl::check(snd_seq_open(&p->seq, "default", SND_SEQ_OPEN_OUTPUT, 0), "open");
+  impl::check(snd_seq_set_client_name(p->seq, "pianoterm"), "name the client");
+
+  p->port = snd_seq_create_simple_port(p->seq, "pianoterm output",
+				       SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+				       SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+  impl::check(p->port, "create a port");
+
+  snd_seq_addr_t destination;
+  if (snd_seq_parse_address(p->seq, &destination, address.c_str()) < 0)
+  {
+    throw std::runtime_error("Error: no ALSA sequencer port at " + address + " (see aconnect -l)");
+  }
+  impl::check(snd_seq_connect_to(p->seq, p->port, destination.client, destination.port), "connect to " + address);
+
+  impl::check(snd_midi_event_new(256, &p->encoder), "create an encoder");
+
+  p->queue = snd_seq_alloc_named_queue(p->seq, "pianoterm");
+  impl::check(p->queue, "create a queue");
+  impl::check(snd_seq_start_queue(p->seq, p->queue, nullptr), "start the queue");
+  impl::check(snd_seq_drain_output(p->seq), "start the queue");
+  p->origin = monotonic_now();
+}
+
+alsa_output::~alsa_output()
+{
+}
+
+void alsa_output::send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time)
+{
+  p->output(bytes, size, p->queue_time_of(time));
+  impl::check(snd_seq_drain_output(p->seq), "send the events");
+}
+
+void alsa_output::send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time)
+{
+  const auto queue_time = p->queue_time_of(time);
+  for (const auto& message : messages)
+  {
+    p->output(message.begin(), message.size(), queue_time);
+  }
+
+  // a single write for the whole music event
+  impl::check(snd_seq_drain_output(p->seq), "send the events");
+}
+
+// 120 beats per minute and 5000 ticks per quarter note: a tick is 100us
+static constexpr const uint32_t file_us_per_quarter = 500000;
+static constexpr const uint16_t file_ticks_per_quarter = 5000;
+static constexpr const std::chrono::microseconds file_tick { 100 };
+
+static void append_variable_length(std::vector<uint8_t>& data, uint32_t value)
+{
+  uint8_t bytes[4];
+  unsigned int nb_bytes = 0;
+  do
+  {
+    bytes[nb_bytes++] = static_cast<uint8_t>(value & 0x7F);
+    value >>= 7;
+  } while (value != 0);
+
+  while (nb_bytes > 1)
+  {
+    data.push_back(static_cast<uint8_t>(bytes[--nb_bytes] | 0x80));
+  }
+  data.push_back(bytes[0]);
+}
+
+static void append_big_endian(std::vector<uint8_t>& data, uint32_t value, unsigned int nb_bytes)
+{
+  while (nb_bytes > 0)
+  {
+    --nb_bytes;
+    data.push_back(static_cast<uint8_t>(value >> (8 * nb_bytes)));
+  }
+}
+
+midi_file_output::midi_file_output(const std::string& init_filename)
+  : filename (init_filename)
+  , file (init_filename, std::ios::binary | std::ios::trunc)
+  , track ()
+  , has_origin (false)
+  , origin (0)
+  , last_tick (0)
+{
+  if (not file)
+  {
+    throw std::runtime_error("Error: can't write the midi file " + filename);
+  }
+
+  // the tempo the ticks are counted in
+  append_variable_length(track, 0);
+  track.insert(track.end(), { 0xFF, 0x51, 0x03 });
+  append_big_endian(track, file_us_per_quarter, 3);
+}
+
+midi_file_output::~midi_file_output()
+{
+  append_variable_length(track, 0);
+  track.insert(track.end(), { 0xFF, 0x2F, 0x00 }); // end of track
+
+  // format 0: a single track
+  std::vector<uint8_t> header { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1 };
+  append_big_endian(header, file_ticks_per_quarter, 2);
+  header.insert(header.end(), { 'M', 'T', 'r', 'k' });
+  append_big_endian(header, static_cast<uint32_t>(track.size()), 4);
+
+  file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+  file.write(reinterpret_cast<const char*>(track.data()), static_cast<std::streamsize>(track.size()));
+  file.close();
+
+  // nothing else can be done from a destructor
+  if (not file)
+  {
+    std::cerr << "Error: couldn't write the midi file " << filename << "\n";
+  }
+}
+
+void midi_file_output::send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time)
+{
+  // only the channel messages and the complete sysex can be stored
+  const bool is_sysex = (size >= 2) and (bytes[0] == 0xF0);
+  if ((size == 0) or (bytes[0] < 0x80) or ((bytes[0] >= 0xF0) and (not is_sysex)))
+  {
+    return;
+  }
+
+  if (not has_origin)
+  {
+    origin = time;
+    has_origin = true;
+  }
+
+  // a message due before the previous one is written along with it
+  const auto tick = static_cast<uint64_t>(std::max(time - origin, std::chrono::nanoseconds{ 0 }) / file_tick);
+  auto delta = (tick > last_tick) ? tick - last_tick : 0;
+  last_tick = std::max(tick, last_tick);
+
+  // a longer silence than a delta time can hold (7 hours) is split by empty
+  // text events
+  constexpr const uint64_t max_delta = 0x0FFFFFFF;
+  while (delta > max_delta)
+  {
+    append_variable_length(track, static_cast<uint32_t>(max_delta));
+    track.insert(track.end(), { 0xFF, 0x01, 0x00 });
+    delta -= max_delta;
+  }
+  append_variable_length(track, static_cast<uint32_t>(delta));
+
+  if (is_sysex)
+  {
+    track.push_back(0xF0);
+    append_variable_length(track, static_cast<uint32_t>(size - 1));
+    track.insert(track.end(), bytes + 1, bytes + size);
+  }
+  else
+  {
+    track.insert(track.end(), bytes, bytes + size);
+  }
+}
+
+counting_output::counting_output()
+  : nb_messages (0)
+  , nb_bytes (0)
+  , next (nullptr)
+{
+}
+
+counting_output::counting_output(midi_output& init_next)
+  : nb_messages (0)
+  , nb_bytes (0)
+  , next (&init_next)
+{
+}
+
+void counting_output::send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time)
+{
+  ++nb_messages;
+  nb_bytes += size;
+
+  if (next != nullptr)
+  {
+    next->send(bytes, size, time);
+  }
+}
+
+void counting_output::send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time)
+{
+  nb_messages += messages.size();
+  for (const auto& message : messages)
+  {
+    nb_bytes += message.size();
+  }
+
+  if (next != nullptr)
+  {
+    next->send_all(messages, time);
+  }
+}
+
+bool get_output_backend(const std::string& name, enum output_backend& res)
+{
+  if (name == "rtmidi")
+  {
+    res = output_backend::rtmidi;
+  }
+  else if (name == "alsa")
+  {
+    res = output_backend::alsa;
+  }
+  else if (name == "file")
+  {
+    res = output_backend::file;
+  }
+  else if (name == "null")
+  {
+    res = output_backend::null;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<midi_output> make_midi_output(enum output_backend backend, const std::string& port)
+{
+  switch (backend)
+  {
+    case output_backend::rtmidi:
+      return std::unique_ptr<midi_output>(new rtmidi_output(get_port(port)));
+
+    case output_backend::alsa:
+      return std::unique_ptr<midi_output>(new alsa_output(port));
+
+    case output_backend::file:
+      return std::unique_ptr<midi_output>(new midi_file_output(port));
+
+    case output_backend::null:
+      return std::unique_ptr<midi_output>(new counting_output());
+
+#if !defined(__clang__)
+// clang complains that all values are handled in the switch and issue
+// a warning for the default case
+// gcc complains about a missing default
+    default:
+      __builtin_unreachable();
+#endif
+  }
+}
@@ -0,0 +1,129 @@
+#ifndef MIDI_OUTPUT_HH_
+#define MIDI_OUTPUT_HH_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+#include "utils.hh"
+
+class RtMidiOut;
+
+// where the player sends the midi messages to. The time given with the
+// messages is when they are due on the player's clock (CLOCK_MONOTONIC,
+// unless benchmarking): they are sent at that time, or a bit later.
+// Only one thread sends at a time.
+class midi_output
+{
+  public:
+    virtual ~midi_output();
+
+    virtual void send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time) = 0;
+
+    // the messages of a music event, all due at the same time. By default
+    // they are sent one by one: the backends able to write them at once
+    // override it.
+    virtual void send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time);
+};
+
+// sends to a midi port opened with RtMidi, through ALSA, like the ports
+// list_midi_ports gives
+class rtmidi_output final : public midi_output
+{
+  public:
+    explicit rtmidi_output(unsigned int midi_port);
+    ~rtmidi_output() override;
+
+    rtmidi_output(const rtmidi_output&) = delete;
+    rtmidi_output& operator=(const rtmidi_output&) = delete;
+
+    void send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time) override;
+
+  private:
+    std::unique_ptr<RtMidiOut> port;
+};
+
+// sends to an ALSA sequencer port directly. The events are scheduled on an
+// ALSA queue at the time they are due, so they carry that timestamp, and
+// the ones of a music event are written at once.
+class alsa_output final : public midi_output
+{
+  public:
+    // address is what aconnect understands: client:port, or a client name
+    explicit alsa_output(const std::string& address);
+    ~alsa_output() override;
+
+    alsa_output(const alsa_output&) = delete;
+    alsa_output& operator=(const alsa_output&) = delete;
+
+    void send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time) override;
+    void send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time) override;
+
+  private:
+    struct impl;
+    std::unique_ptr<struct impl> p;
+};
+
+// records what is sent to a standard midi file, written when the output is
+// destroyed. The messages are timed by when they were due, so playing the
+// file gives back what was played, without the delays of the machine.
+class midi_file_output final : public midi_output
+{
+  public:
+    explicit midi_file_output(const std::string& filename);
+    ~midi_file_output() override;
+
+    midi_file_output(const midi_file_output&) = delete;
+    midi_file_output& operator=(const midi_file_output&) = delete;
+
+    void send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time) override;
+
+  private:
+    std::string filename;
+    std::ofstream file; // opened right away, not to find out it can't be written once the song is over
+    std::vector<uint8_t> track; // the events of the only track of the file
+    bool has_origin;
+    std::chrono::nanoseconds origin; // the time of the first message
+    uint64_t last_tick;
+};
+
+// only counts what it is given, then passes it on to the next output, if any
+class counting_output final : public midi_output
+{
+  public:
+    counting_output();
+    explicit counting_output(midi_output& init_next);
+
+    counting_output(const counting_output&) = delete;
+    counting_output& operator=(const counting_output&) = delete;
+
+    void send(const uint8_t* bytes, std::size_t size, std::chrono::nanoseconds time) override;
+    void send_all(const array_view<midi_message>& messages, std::chrono::nanoseconds time) override;
+
+    uint64_t nb_messages;
+    uint64_t nb_bytes;
+
+  private:
+    midi_output* next;
+};
+
+enum class output_backend
+{
+  rtmidi,
+  alsa,
+  file,
+  null,
+};
+
+// returns false if the name is none of rtmidi, alsa, file and null
+bool get_output_backend(const std::string& name, enum output_backend& res);
+
+// the output of the given backend: rtmidi and alsa send to the given port,
+// file records to the given file, and null only counts.
+std::unique_ptr<midi_output> make_midi_output(enum output_backend backend, const std::string& port);
+
+#endif /* MIDI_OUTPUT_HH_ */
@@ -2,89 +2,131 @@
 #include <iostream>
 #include <cstring> // for std::memcmp and std::memset
 #include <stdexcept>
-#include <fstream>
+#include <cstddef> // for std::size_t
+#include <exception>
+#include <memory>
 
 #include "midi_reader.hh"
+#include "mapped_file.hh"
+#include "parallel.hh"
+
+// bounds checked reader over an in-memory buffer (usually the mapped midi
+// file). Reading past the end throws overrun_error, which lets the caller
+// choose the diagnostic matching the area being read (e.g. a track chunk).
+struct byte_cursor
+{
+    const uint8_t* pos;
+    const uint8_t* end;
+    const char* overrun_error;
+
+    std::size_t remaining() const
+    {
+      return static_cast<std::size_t>(end - pos);
+    }
+
+    void ensure_available(std::size_t nb_bytes) const
+    {
+      if (remaining() < nb_bytes)
+      {
+	throw std::invalid_argument(overrun_error);
+      }
+    }
+
+    uint8_t peek() const
+    {
+      ensure_available(1);
+      return *pos;
+    }
+};
+
+static const char* const unexpected_end_of_file = "Error: invalid midi file (unexpected end of file)";
+static const char* const incoherent_track_length = "Error in midi file: incoherent track length detected.";
 
 template <typename T>
-static T read_big_endian(std::fstream& file)
+static T read_big_endian(byte_cursor& file)
 {
+  file.ensure_available(sizeof(T));
+
   T res = 0;
   for (unsigned int i = 0; i < sizeof(T); ++i)
   {
-    uint8_t tmp;
-    file.read(static_cast<char*>(static_cast<void*>(&tmp)), sizeof(tmp));
-    res = static_cast<decltype(res)>( (res << 8) | tmp);
+    res = static_cast<decltype(res)>( (res << 8) | file.pos[i]);
   }
+  file.pos += sizeof(T);
   return res;
 }
 
-static inline uint16_t read_big_endian16(std::fstream& file)
+static inline uint16_t read_big_endian16(byte_cursor& file)
 {
   return read_big_endian<uint16_t>(file);
 }
 
-static inline uint32_t read_big_endian32(std::fstream& file)
+static inline uint32_t read_big_endian32(byte_cursor& file)
 {
   return read_big_endian<uint32_t>(file);
 }
 
-static std::vector<uint8_t> get_variable_length_array(std::fstream& file)
+// returns the number of bytes used by the variable length value starting at
+// the cursor position, without consuming them.
+static std::size_t get_variable_length_size(const byte_cursor& file)
 {
-  std::vector<uint8_t> res;
+  std::size_t res = 0;
   uint8_t value;
 
   do
   {
-    value = read_big_endian<uint8_t>(file);
-    res.push_back(value);
+    file.ensure_available(res + 1);
+    value = file.pos[res];
+    res++;
   } while ((value & 0x80) != 0); // while the continuation bit is set.
 
   return res;
 }
 
-static uint64_t get_variable_length_value(const std::vector<uint8_t>& array)
+static uint64_t get_variable_length_value(byte_cursor& file, std::size_t nb_bytes)
 {
   // recreate the right value by removing the continuation bits
   uint64_t res = 0;
 
-  if (array.size() > sizeof(res))
+  if (nb_bytes > sizeof(res))
   {
-    throw std::invalid_argument("This program can't handle a variable length value with more than 8 bytes. Bytes used: " + std::to_string(array.size()));
+    throw std::invalid_argument("This program can't handle a variable length value with more than 8 bytes. Bytes used: " + std::to_string(nb_bytes));
   }
 
-  const auto nb_elts = array.size();
-  for (auto i = decltype(nb_elts){0}; i < nb_elts; ++i)
+  for (auto i = decltype(nb_bytes){0}; i < nb_bytes; ++i)
   {
-    res |= static_cast<decltype(res)>((array[nb_elts - i - 1] & 0x7F) << 7 * i);
+    res = (res << 7) | static_cast<decltype(res)>(file.pos[i] & 0x7F);
   }
+  file.pos += nb_bytes;
 
   return res;
 }
 
 // reads a variable length value. BUT it must be four bytes maximum.
 // otherwise it is not valid.
-static uint32_t get_relative_time(std::fstream& file)
+static uint32_t get_relative_time(byte_cursor& file)
 {
-  // recreate the right value by removing the continuation bits
-  const auto buffer = get_variable_length_array(file);
+  const auto nb_bytes = get_variable_length_size(file);
 
-  if (buffer.size() > 4)
+  if (nb_bytes > 4)
   {
-    throw std::invalid_argument("Invalid relative timing found.\nMaximum size allowed is 4 bytes. Bytes used: " + std::to_string(buffer.size()));
+    throw std::invalid_argument("Invalid relative timing found.\nMaximum size allowed is 4 bytes. Bytes used: " + std::to_string(nb_bytes));
   }
 
-  return static_cast<uint32_t>(get_variable_length_value(buffer));
+  return static_cast<uint32_t>(get_variable_length_value(file, nb_bytes));
 }
 
 
-static bool is_header_correct(std::fstream& file, const char expected[4])
+static bool is_header_correct(byte_cursor& file, const char expected[4])
 {
-  char buffer[4];
-  file.read(buffer, sizeof(buffer));
+  if (file.remaining() < 4)
+  {
+    return false;
+  }
 
-  return (static_cast<unsigned>(file.gcount()) == sizeof(buffer)) and
-    (std::memcmp(buffer, expected, sizeof(buffer)) == 0);
+  const bool res = (std::memcmp(file.pos, expected, 4) == 0);
+  file.pos += 4;
+  return res;
 }
 
 enum MIDI_TYPE : uint8_t
@@ -94,7 +136,7 @@ enum MIDI_TYPE : uint8_t
   multiple_song = 2, // i.e. a series of type 0
 };
 
-static enum MIDI_TYPE get_midi_type(std::fstream& file)
+static enum MIDI_TYPE get_midi_type(byte_cursor& file)
 {
    switch (read_big_endian16(file))
    {
@@ -109,13 +151,7 @@ static enum MIDI_TYPE get_midi_type(std::fstream& file)
    }
 }
 
-enum tempo_style : bool
-{
-  metrical_timing,
-  timecode,
-};
-
-static uint16_t get_tickdiv(std::fstream& file, /* out param */ enum tempo_style& timing_type)
+static uint16_t get_tickdiv(byte_cursor& file, /* out param */ enum tempo_style& timing_type)
 {
   // http://midi.mathewvp.com/aboutMidi.htm
 
@@ -130,8 +166,9 @@ static uint16_t get_tickdiv(std::fstream& file, /* out param */ enum tempo_style
   // values may be 4 (MIDI Time Code), 8, 10, 80 (SMPTE bit resolution), or 100.
   // You can specify millisecond-based timing by the data bytes of -25 and 40
   // subframes.
-  int8_t bytes[2];
-  file.read(static_cast<char*>(static_cast<void*>(bytes)), sizeof(bytes));
+  file.ensure_available(2);
+  const int8_t bytes[2] = { static_cast<int8_t>(file.pos[0]), static_cast<int8_t>(file.pos[1]) };
+  file.pos += 2;
   if (bytes[0] >= 0)
   {
     timing_type = tempo_style::metrical_timing;
@@ -162,18 +199,32 @@ static uint16_t get_tickdiv(std::fstream& file, /* out param */ enum tempo_style
 }
 
 
-static struct midi_event get_event(std::fstream& file, uint8_t last_status_byte)
+// an event as decoded from a track. Channel events are stored inline. Sysex
+// and meta events keep their status (and meta type) inline, but their data
+// is left where it is: in the mapped file, the byte arena they all share,
+// which outlives the parsing.
+struct track_event
 {
-  struct midi_event res;
-  // get_relative_time returns MIDI tics. These are the number of tics that occured since the former event
-  // if the song uses the metrical timing tempo_style, or since the beginning of the song if it used the timecode
-  // tempo_style. These are *NOT* in a dimension of seconds. Therefore assigning them to res.time which is of type
-  // nanoseconds is wrong here. instead, there should which denote a midi tics that should be used here.
-  // In order not to create too many types, and avoid some memory and copies overhead, the .time field is used here
-  // to stop the midi tics.
-  // There will be a step later on that will transfer these midi tics (wrongly stored as nanoseconds here), into
-  // the real naonseconds value, based on the tempo style. See function set_real_timings.
-  res.time = std::chrono::nanoseconds{ get_relative_time(file) };
+    uint64_t tick; // since the beginning of the track
+    midi_message message;
+    uint32_t payload_size; // sysex and meta events only
+    const uint8_t* payload; // sysex and meta events only
+
+    track_event()
+      : tick (std::numeric_limits<decltype(tick)>::max())
+      , message ()
+      , payload_size (0)
+      , payload (nullptr)
+    {
+    }
+};
+
+static struct track_event get_event(byte_cursor& file, uint8_t last_status_byte)
+{
+  struct track_event res;
+  // the number of ticks since the previous event of the track. The caller
+  // makes it relative to the beginning of the track.
+  res.tick = get_relative_time(file);
 
   // an event can be of three form: Control event, META event, or System
   // Exclusive event. See http://www.sonicspot.com/guide/midifiles.html
@@ -181,31 +232,33 @@ static struct midi_event get_event(std::fstream& file, uint8_t last_status_byte)
 			  ? last_status_byte
 			  : read_big_endian<uint8_t>(file);
 
-  res.data.push_back(event_type);
+  uint8_t bytes[3] = { event_type, 0, 0 };
+  std::size_t nb_bytes = 1;
 
   if (event_type == 0xFF)
   {
     // this is a META Event
-    res.data.push_back(read_big_endian<uint8_t>(file)); // type of META event
+    bytes[nb_bytes++] = read_big_endian<uint8_t>(file); // type of META event
     // for the rest, a META event is just like a sysex one.
   }
 
   if ((event_type == 0xFF) or (event_type == 0xF0) or (event_type == 0xF7))
   {
     // this is a sysex event, or the end of a META event.
+    res.message = midi_message(bytes, nb_bytes);
 
-    const auto length_array = get_variable_length_array(file);
-    const auto length = get_variable_length_value(length_array);
-
-    // Append the length array at the end of res.data
-    std::move(length_array.begin(), length_array.end(), std::back_inserter(res.data));
+    const auto length_size = get_variable_length_size(file);
+    const auto length = get_variable_length_value(file, length_size);
 
-    // the data
-    for (auto i = decltype(length){0}; i < length; ++i)
+    if ((length > file.remaining()) or (length > std::numeric_limits<decltype(res.payload_size)>::max()))
     {
-      res.data.push_back(read_big_endian<uint8_t>(file));
+      throw std::invalid_argument(file.overrun_error);
     }
 
+    res.payload = file.pos;
+    res.payload_size = static_cast<decltype(res.payload_size)>(length);
+    file.pos += length;
+
     return res;
   }
 
@@ -215,28 +268,32 @@ static struct midi_event get_event(std::fstream& file, uint8_t last_status_byte)
 	or ((event_type & 0xF0) == 0xD0)) /* or Channel Aftertouch Event */
     {
       // one more byte
-      res.data.push_back(read_big_endian<uint8_t>(file));
+      bytes[nb_bytes++] = read_big_endian<uint8_t>(file);
     }
     else
     {
       // this is a MIDI channel event (more two bytes)
-      res.data.push_back(read_big_endian<uint8_t>(file));
-      res.data.push_back(read_big_endian<uint8_t>(file));
+      bytes[nb_bytes++] = read_big_endian<uint8_t>(file);
+      bytes[nb_bytes++] = read_big_endian<uint8_t>(file);
     }
+    res.message = midi_message(bytes, nb_bytes);
     return res;
   }
 
   throw std::invalid_argument("Error: invalid type of MIDI event");
 }
 
-// read the midi events from the track and pushes them at the end of res
-//
-// MIDI format 1 (multiple track) can't have tempo event after the first track.
-// call with the last to true when reading track 2+ from a format 1 to ensure
-// validity check.
-static void get_track_events(std::vector<struct midi_event>& res,
-			     std::fstream& file,
-			     bool fail_on_tempo_event)
+// location of the events of a track chunk in the file
+struct track_chunk
+{
+    const uint8_t* begin; // first byte after the chunk header
+    const uint8_t* end; // end announced by the chunk length (clamped to the end of the file)
+    uint32_t length; // length announced in the chunk header
+};
+
+// reads the header of a track chunk and skips its events, trusting the
+// length announced in the header.
+static struct track_chunk get_track_chunk(byte_cursor& file)
 {
   // http://www.ccarh.org/courses/253/handout/smf/
   //
@@ -259,117 +316,246 @@ static void get_track_events(std::vector<struct midi_event>& res,
   }
 
   const auto track_length = read_big_endian32(file);
-  const auto track_start = file.tellg();
 
-  // reset the current time for the beginning of the track
-  bool end_of_track_found = false;
-  uint8_t last_status_byte = 0x00; // 0 is an invalid status byte (i.e. type of midi event)
-  std::chrono::nanoseconds::rep this_time = 0;
-
-  do
-  {
-    res.emplace_back( get_event(file, last_status_byte) );
-    auto& event = res.back();
-    // This functions handles midi tics which are not in a unit of seconds. However, let's write it in the time field
-    // for now, and fix it to proper nanoseconds later.
-    event.time += std::chrono::nanoseconds{ this_time };
-    this_time = event.time.count();
-
-    last_status_byte = event.data[0];
-    end_of_track_found = (event.data[0] == 0xff) and (event.data[1] == 0x2f);
+  const struct track_chunk res = { file.pos,
+				   file.pos + std::min<std::size_t>(track_length, file.remaining()),
+				   track_length };
+  file.pos = res.end;
+  return res;
+}
 
-    if ((event.data[0] == 0xff) and (event.data[1] == 0x51) // this is a tempo event
-	and fail_on_tempo_event)
+// decodes the events of a track chunk one after the other. Since the events
+// of a track are stored by increasing time, they come in time order.
+//
+// MIDI format 1 (multiple track) can't have tempo event after the first track.
+// fail_on_tempo_event must be set when reading track 2+ from a format 1 to
+// ensure validity check.
+struct track_decoder
+{
+    byte_cursor track;
+    struct track_chunk chunk;
+    bool fail_on_tempo_event;
+    uint8_t last_status_byte;
+    uint64_t tick;
+
+    track_decoder(const struct track_chunk& init_chunk, bool init_fail_on_tempo_event)
+      // the events are decoded within the limits of the chunk. Running out of
+      // bytes before the end of track event means the length is wrong.
+      : track { init_chunk.begin, init_chunk.end, incoherent_track_length }
+      , chunk (init_chunk)
+      , fail_on_tempo_event (init_fail_on_tempo_event)
+      , last_status_byte (0x00) // 0 is an invalid status byte (i.e. type of midi event)
+      , tick (0)
     {
-      throw std::invalid_argument("Error: tempo event found at a forbidden place.");
     }
 
-  }
-  while (!end_of_track_found);
+    // decodes the next event, its tick being relative to the beginning of the
+    // track. Returns false once the end of track event is reached.
+    bool next(struct track_event& event)
+    {
+      event = get_event(track, last_status_byte);
+      event.tick += tick;
+      tick = event.tick;
+
+      last_status_byte = event.message[0];
+
+      if ((event.message[0] == 0xff) and (event.message[1] == 0x51) // this is a tempo event
+	  and fail_on_tempo_event)
+      {
+	throw std::invalid_argument("Error: tempo event found at a forbidden place.");
+      }
+
+      const bool end_of_track_found = (event.message[0] == 0xff) and (event.message[1] == 0x2f);
+      if (end_of_track_found and (static_cast<std::size_t>(track.pos - chunk.begin) != chunk.length))
+      {
+	throw std::invalid_argument(incoherent_track_length);
+      }
 
-  const auto track_end = file.tellg();
+      return not end_of_track_found;
+    }
+};
+
+// decodes the midi events of a track, by increasing time.
+static std::vector<struct track_event> get_track_events(const struct track_chunk& chunk,
+							bool fail_on_tempo_event)
+{
+  std::vector<struct track_event> res;
 
-  if ((track_end - track_start) != track_length)
+  struct track_decoder decoder (chunk, fail_on_tempo_event);
+  struct track_event event;
+  while (decoder.next(event))
   {
-    throw std::invalid_argument("Error in midi file: incoherent track length detected.");
+    res.push_back(event);
   }
+
+  return res;
 }
 
-// the time correspond to midi tics when calling the function.
-// it is replaced by real time (dimension of a second)
-static void set_real_timings(std::vector<struct midi_event>& events,
-			     const uint16_t tickdiv,
-			     const enum tempo_style timing_type)
+// min-heap of the next event of each track, keyed by (tick, track).
+//
+// The heap is maintained by hand, with unsigned positions: the std heap
+// algorithms trip -Wstrict-overflow on their signed distances.
+class track_heap
 {
-  // precondition: the events must be sorted by ticks
-  if (! std::is_sorted( events.begin(), events.end(), [] (const struct midi_event& a, const struct midi_event& b) {
-	return a.time < b.time;
-      }))
-  {
-    throw std::runtime_error("Error: the events are not sorted.");
-  }
+  public:
+    struct head
+    {
+	uint64_t tick;
+	std::size_t track;
+	std::size_t pos; // in the track, for the callers needing it
+    };
 
-  switch (timing_type)
-  {
-    case timecode:
+    track_heap()
+      : heads ()
     {
-      for (auto& ev : events)
-      {
-	ev.time = std::chrono::nanoseconds{ ev.time.count() * tickdiv * 1000 * 1000 }; // nanosecond
-      }
-      break;
     }
-    case metrical_timing:
+
+    bool empty() const
     {
-      uint64_t ref_ticks = 0;
-      std::chrono::nanoseconds ref_time { 0 };
+      return heads.empty();
+    }
 
-      // default tempo is 120 beats per minutes
-      // 1 minute -> 60 000 000 microseconds
-      // 60000000 / 120 -> 500 000 microseconds per quarter note
-      uint64_t us_per_quarter_note = 500000;
+    struct head& top()
+    {
+      return heads.front();
+    }
 
-      for (auto& ev : events)
+    void push(const struct head& h)
+    {
+      heads.push_back(h);
+
+      // move it up the heap until it is in place
+      auto i = heads.size() - 1;
+      while ((i > 0) and comes_before(heads[i], heads[(i - 1) / 2]))
       {
-	const auto last_ticks = ev.time.count();
-	const auto delta_ticks = static_cast<decltype(ref_ticks)>(last_ticks) - ref_ticks;
-	ev.time = ref_time + std::chrono::nanoseconds{ (delta_ticks * us_per_quarter_note * 1000) / tickdiv };
+	std::swap(heads[i], heads[(i - 1) / 2]);
+	i = (i - 1) / 2;
+      }
+    }
 
-	if ((ev.data[0] == 0xff) and (ev.data[1] == 0x51))
-	{
-	  // this is a tempo event
-	  if (ev.data.size() != 6)
-	  {
-	    throw std::invalid_argument("Error: tempo event has an invalid size");
-	  }
+    void pop()
+    {
+      heads.front() = heads.back();
+      heads.pop_back();
+      sift_down(0);
+    }
+
+    // to call once the tick of the top head moved forward
+    void update_top()
+    {
+      sift_down(0);
+    }
 
-	  ref_ticks = static_cast<decltype(ref_ticks)>(last_ticks);
-	  ref_time = ev.time;
+  private:
+    static bool comes_before(const struct head& a, const struct head& b)
+    {
+      return (a.tick < b.tick) or ((a.tick == b.tick) and (a.track < b.track));
+    }
 
-	  us_per_quarter_note = static_cast<decltype(us_per_quarter_note)>(
-	    (ev.data[3] << 16) | (ev.data[4] << 8) | (ev.data[5]));
+    // moves the head at position i down the heap until it is in place
+    void sift_down(std::size_t i)
+    {
+      const auto nb_heads = heads.size();
+      for (;;)
+      {
+	auto smallest = i;
+	const auto left = (2 * i) + 1;
+	const auto right = left + 1;
+	if ((left < nb_heads) and comes_before(heads[left], heads[smallest]))
+	{
+	  smallest = left;
 	}
+	if ((right < nb_heads) and comes_before(heads[right], heads[smallest]))
+	{
+	  smallest = right;
+	}
+	if (smallest == i)
+	{
+	  return;
+	}
+	std::swap(heads[i], heads[smallest]);
+	i = smallest;
       }
-      break;
     }
-#if !defined(__clang__)
-    // clang will complain that the default case is useless because all
-    // possible values in the enum are already taken into account.
-    // g++ complains of a missing one
-    default:
-      __builtin_unreachable();
-      break;
-#endif
+
+    std::vector<struct head> heads;
+};
+
+// merges the tracks, each one sorted by time, into one sequence sorted by
+// time. Events occuring at the same time are ordered by track, and then by
+// position in their track. This is the order a stable sort of the
+// concatenated tracks would give, in O(n log(nb_tracks)) instead of
+// O(n log(n)).
+static std::vector<struct track_event> merge_tracks(std::vector<std::vector<struct track_event>>& tracks)
+{
+  if (tracks.size() == 1)
+  {
+    return std::move(tracks[0]);
+  }
+
+  std::size_t nb_events = 0;
+  for (const auto& track : tracks)
+  {
+    nb_events += track.size();
+  }
+
+  std::vector<struct track_event> res;
+  res.reserve(nb_events);
+
+  track_heap heads;
+  for (auto i = decltype(tracks.size()){0}; i < tracks.size(); ++i)
+  {
+    if (not tracks[i].empty())
+    {
+      heads.push({ tracks[i][0].tick, i, 0 });
+    }
+  }
+
+  while (not heads.empty())
+  {
+    auto& head = heads.top();
+    auto& track = tracks[head.track];
+
+    res.emplace_back(std::move(track[head.pos]));
+    head.pos++;
+
+    if (head.pos == track.size())
+    {
+      heads.pop();
+    }
+    else
+    {
+      head.tick = track[head.pos].tick;
+      heads.update_top();
+    }
   }
-}
 
+  return res;
+}
 
-std::vector<struct midi_event> get_midi_events(const std::string& filename)
+// updates the tempo map if the event is a tempo event. Returns true if it
+// was one.
+static bool add_tempo_event(class tempo_map& tempo, enum tempo_style timing_type, const struct track_event& ev)
 {
+  if ((ev.message[0] == 0xff) and (ev.message[1] == 0x51) and (timing_type == tempo_style::metrical_timing))
+  {
+    // this is a tempo event
+    if (ev.payload_size != 3)
+    {
+      throw std::invalid_argument("Error: tempo event has an invalid size");
+    }
+
+    tempo.add_tempo_change(ev.tick, static_cast<uint32_t>((ev.payload[0] << 16) | (ev.payload[1] << 8) | (ev.payload[2])));
+    return true;
+  }
 
-  std::fstream file(filename, std::ios::binary | std::ios::in);
+  return false;
+}
 
-  if (!file.is_open())
+// reports a file which couldn't be opened
+static void ensure_opened(const mapped_file& midi_file, const std::string& filename)
+{
+  if (!midi_file.is_open())
   {
     std::string err_msg = "Error: unable to open midi file [";
     err_msg += filename;
@@ -377,7 +563,18 @@ std::vector<struct midi_event> get_midi_events(const std::string& filename)
 
     throw std::invalid_argument(err_msg);
   }
+}
 
+struct midi_header
+{
+    enum MIDI_TYPE type;
+    uint16_t nb_tracks;
+    uint16_t tickdiv;
+    enum tempo_style timing_type;
+};
+
+static struct midi_header get_header(byte_cursor& file)
+{
   // http://www.ccarh.org/courses/253/handout/smf/
   //
   //    header_chunk = "MThd" + <header_length> + <format> + <n> + <division>
@@ -405,6 +602,7 @@ std::vector<struct midi_event> get_midi_events(const std::string& filename)
   //     per beat. If the value is negative, delta times are in SMPTE
   //     compatible units.
 
+
   const char midi_header[4] = { 'M', 'T', 'h', 'd' };
   if (!is_header_correct(file, midi_header))
   {
@@ -434,43 +632,327 @@ std::vector<struct midi_event> get_midi_events(const std::string& filename)
   enum tempo_style timing_type;
   // read pulses per quarter note
   const auto tickdiv = get_tickdiv(file, timing_type);
-  if (tickdiv == 0)
+
+  return { type, nb_tracks, tickdiv, timing_type };
+}
+
+// indexes the track chunks: their length tells where the next one starts.
+// An invalid chunk stops the indexing, its error is stored in
+// indexing_error for the caller to report it when it sees fit.
+static std::vector<struct track_chunk> get_track_chunks(byte_cursor& file, uint16_t nb_tracks,
+							 /* out param */ std::exception_ptr& indexing_error)
+{
+  std::vector<struct track_chunk> chunks;
+  try
   {
-    throw std::invalid_argument("Error: a quarter note is made of 0 pulses (which is impossible) according to the midi data");
+    for (auto i = decltype(nb_tracks){0}; i < nb_tracks; i++)
+    {
+      chunks.push_back(get_track_chunk(file));
+    }
+  }
+  catch (std::invalid_argument&)
+  {
+    indexing_error = std::current_exception();
   }
 
-  std::vector<struct midi_event> events; // the return value
+  return chunks;
+}
+
+std::vector<struct midi_event> get_midi_events(const std::string& filename, class tempo_map& tempo, enum track_decoding decoding)
+{
+
+  const mapped_file midi_file(filename);
+  ensure_opened(midi_file, filename);
+
+  byte_cursor file = { midi_file.begin(), midi_file.end(), unexpected_end_of_file };
+
+  const auto header = get_header(file);
+  const auto type = header.type;
+  const auto timing_type = header.timing_type;
+  tempo = tempo_map(header.tickdiv, timing_type);
+
+  // index the track chunks first, so that the tracks can then be decoded
+  // independently.
+  std::exception_ptr indexing_error;
+  const auto chunks = get_track_chunks(file, header.nb_tracks, indexing_error);
+
+  std::vector<std::vector<struct track_event>> tracks (chunks.size());
+  const auto decode_track = [&] (std::size_t i) {
+    tracks[i] = get_track_events(chunks[i], (type == MIDI_TYPE::multiple_track) and (i != 0));
+  };
+
+  switch (decoding)
+  {
+    case parallel_decoding:
+      // rethrows the error of the first invalid track, if any
+      parallel_for(chunks.size(), decode_track);
+      break;
+
+    case sequential_decoding:
+      for (auto i = decltype(chunks.size()){0}; i < chunks.size(); ++i)
+      {
+	decode_track(i);
+      }
+      break;
+
+#if !defined(__clang__)
+    // clang will complain that the default case is useless because all
+    // possible values in the enum are already taken into account.
+    // g++ complains of a missing one
+    default:
+      __builtin_unreachable();
+      break;
+#endif
+  }
 
-  // read the tracks
-  for (auto i = decltype(nb_tracks){0}; i < nb_tracks; i++)
+  // reported after the tracks indexed so far are decoded, as they come first
+  // in the file.
+  if (indexing_error)
   {
-    get_track_events(events, file, (type == MIDI_TYPE::multiple_track) and (i != 0));
+    std::rethrow_exception(indexing_error);
   }
 
   // sanity check: the midi file should have been entirely read by now (no more
   // remaining bytes)
-  file.peek(); // just to set the eof bit.
-  if (not file.eof())
+  if (file.remaining() != 0)
   {
     throw std::invalid_argument("Error: invalid midi file (extra bytes after end of MIDI data)");
   }
 
-  // sort the events by time
-  std::stable_sort(events.begin(), events.end(), [] (const struct midi_event& a, const struct midi_event& b) {
-      return a.time < b.time;
-    });
+  // put the events of all tracks in time order
+  auto events = merge_tracks(tracks);
 
-  set_real_timings(events, tickdiv, timing_type);
-
-  // only keep MIDI events (filter out sysex and meta events)
-  decltype(events) res;
+  // only keep MIDI events (filter out sysex and meta events). The payloads of
+  // the latter point in the mapped file, which is about to be unmapped.
+  std::vector<struct midi_event> res;
+  res.reserve(events.size());
   for (const auto& ev : events)
   {
-    if ((ev.data[0] & 0xF0) != 0xF0)
+    if ((ev.message[0] & 0xF0) != 0xF0)
     {
-      res.emplace_back(ev);
+      res.emplace_back(ev.tick, ev.message);
+    }
+    else
+    {
+      add_tempo_event(tempo, timing_type, ev);
     }
   }
 
   return res;
 }
+
+
+// the header chunk, and the header of the first track chunk
+static constexpr const std::size_t file_header_size = 14;
+static constexpr const std::size_t track_header_size = 8;
+
+struct midi_event_stream::impl
+{
+    mapped_file midi_file;
+    enum tempo_style timing_type;
+    class tempo_map tempo;
+
+    // a single track file read from a pipe is decoded as its bytes come
+    bool is_streamed;
+
+    // the decoder of each track, and its next event, when there is one
+    std::vector<struct track_decoder> decoders;
+    std::vector<struct track_event> next_events;
+    track_heap heads;
+
+    explicit impl(const std::string& filename)
+      : midi_file (filename, true)
+      , timing_type ()
+      , tempo ()
+      , is_streamed (false)
+      , decoders ()
+      , next_events ()
+      , heads ()
+    {
+    }
+
+    // reads the next bytes of a streamed file. Its only decoder is moved
+    // along with them, and sees them. Returns false once the whole file
+    // has been read.
+    bool read_more()
+    {
+      auto& decoder = decoders.front();
+      const auto pos = static_cast<std::size_t>(decoder.track.pos - midi_file.begin());
+      const auto chunk_begin = static_cast<std::size_t>(decoder.chunk.begin - midi_file.begin());
+
+      const bool res = midi_file.read_more();
+
+      decoder.chunk.begin = midi_file.begin() + chunk_begin;
+      decoder.chunk.end = decoder.chunk.begin + std::min<std::size_t>(decoder.chunk.length, midi_file.size() - chunk_begin);
+      decoder.track.pos = midi_file.begin() + pos;
+      decoder.track.end = decoder.chunk.end;
+      return res;
+    }
+
+    // decodes the next event of the track, reading the bytes of a streamed
+    // file as they are needed.
+    bool next_event(std::size_t track, struct track_event& event)
+    {
+      if (not is_streamed)
+      {
+	return decoders[track].next(event);
+      }
+
+      bool res;
+      for (;;)
+      {
+	// the event may be decoded again, once more of its bytes are there
+	auto decoder = decoders[track];
+	try
+	{
+	  res = decoder.next(event);
+	  decoders[track] = decoder;
+	  break;
+	}
+	catch (std::invalid_argument&)
+	{
+	  // the error is only real if there was no missing byte
+	  if ((static_cast<std::size_t>(decoder.chunk.end - decoder.chunk.begin) == decoder.chunk.length) or (not read_more()))
+	  {
+	    throw;
+	  }
+	}
+      }
+
+      // the bytes after the track, which couldn't be checked while indexing
+      if (not res)
+      {
+	while (read_more())
+	{
+	}
+
+	if (decoders[track].track.pos != midi_file.end())
+	{
+	  throw std::invalid_argument("Error: invalid midi file (extra bytes after end of MIDI data)");
+	}
+      }
+
+      return res;
+    }
+};
+
+midi_event_stream::midi_event_stream(const std::string& filename)
+  : p (new impl(filename))
+{
+  ensure_opened(p->midi_file, filename);
+
+  // a pipe gives its bytes as they come. The events of a single track file
+  // can be decoded as they do. But the tracks of the other files come one
+  // after the other, they have to be all there to be merged.
+  while ((p->midi_file.size() < file_header_size + track_header_size) and p->midi_file.read_more())
+  {
+  }
+
+  if (not p->midi_file.is_complete())
+  {
+    byte_cursor file = { p->midi_file.begin(), p->midi_file.end(), unexpected_end_of_file };
+    p->is_streamed = (get_header(file).type == MIDI_TYPE::single_track);
+    if (not p->is_streamed)
+    {
+      while (p->midi_file.read_more())
+      {
+      }
+    }
+  }
+
+  byte_cursor file = { p->midi_file.begin(), p->midi_file.end(), unexpected_end_of_file };
+
+  const auto header = get_header(file);
+  p->timing_type = header.timing_type;
+  p->tempo = tempo_map(header.tickdiv, header.timing_type);
+
+  std::exception_ptr indexing_error;
+  const auto chunks = get_track_chunks(file, header.nb_tracks, indexing_error);
+  if (indexing_error)
+  {
+    // the tracks indexed so far come first in the file: their errors are
+    // reported first, as get_midi_events does.
+    for (auto i = decltype(chunks.size()){0}; i < chunks.size(); ++i)
+    {
+      get_track_events(chunks[i], (header.type == MIDI_TYPE::multiple_track) and (i != 0));
+    }
+    std::rethrow_exception(indexing_error);
+  }
+
+  // sanity check: the midi file should have been entirely indexed by now (no
+  // more remaining bytes). The bytes of a streamed file which are not there
+  // yet are checked once its track is decoded.
+  if (file.remaining() != 0)
+  {
+    throw std::invalid_argument("Error: invalid midi file (extra bytes after end of MIDI data)");
+  }
+
+  p->decoders.reserve(chunks.size());
+  p->next_events.resize(chunks.size());
+  for (auto i = decltype(chunks.size()){0}; i < chunks.size(); ++i)
+  {
+    p->decoders.emplace_back(chunks[i], (header.type == MIDI_TYPE::multiple_track) and (i != 0));
+    if (p->next_event(i, p->next_events[i]))
+    {
+      p->heads.push({ p->next_events[i].tick, i, 0 });
+    }
+  }
+}
+
+midi_event_stream::~midi_event_stream() = default;
+
+bool midi_event_stream::read_until(std::chrono::nanoseconds song_time, std::vector<struct midi_event>& res)
+{
+  if (song_time.count() < 0)
+  {
+    return not p->heads.empty();
+  }
+
+  // the events are compared in ticks. A tempo change moves the tick of the
+  // song time.
+  auto last_tick = p->tempo.tick_of(song_time);
+
+  while (not p->heads.empty())
+  {
+    auto& head = p->heads.top();
+    auto& ev = p->next_events[head.track];
+
+    if (ev.tick > last_tick)
+    {
+      return true;
+    }
+
+    // only keep MIDI events (filter out sysex and meta events)
+    if ((ev.message[0] & 0xF0) != 0xF0)
+    {
+      res.emplace_back(ev.tick, ev.message);
+    }
+    else if (add_tempo_event(p->tempo, p->timing_type, ev))
+    {
+      last_tick = p->tempo.tick_of(song_time);
+    }
+
+    // the payload of the event may be moved from here
+    if (p->next_event(head.track, ev))
+    {
+      head.tick = ev.tick;
+      p->heads.update_top();
+    }
+    else
+    {
+      p->heads.pop();
+    }
+  }
+
+  return false;
+}
+
+const class tempo_map& midi_event_stream::tempo() const
+{
+  return p->tempo;
+}
+
+bool midi_event_stream::identify(struct file_identity& res) const
+{
+  return p->midi_file.identify(res);
+}
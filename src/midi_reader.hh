@@ -5,20 +5,125 @@
 #include <string>
 #include <limits>
 #include <chrono>
+#include <stdexcept>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+#include <memory>
+
+#include "tempo_map.hh"
+#include "mapped_file.hh"
+
+// a midi channel message (at most three bytes). It is stored inline, as
+// allocating a vector for each of the millions of messages of a song costs
+// more than the messages themselves.
+struct midi_message
+{
+    uint8_t bytes[3];
+    uint8_t length;
+
+    midi_message()
+      : bytes {0, 0, 0}
+      , length (0)
+    {
+    }
+
+    midi_message(const uint8_t* data, std::size_t size)
+      : bytes {0, 0, 0}
+      , length (static_cast<uint8_t>(size))
+    {
+      if (size > sizeof(bytes))
+      {
+	throw std::invalid_argument("Error: a midi channel message can't be longer than three bytes");
+      }
+
+      for (auto i = decltype(size){0}; i < size; ++i)
+      {
+	bytes[i] = data[i];
+      }
+    }
+
+    std::size_t size() const
+    {
+      return length;
+    }
+
+    uint8_t operator[](std::size_t i) const
+    {
+      return bytes[i];
+    }
+
+    const uint8_t* begin() const
+    {
+      return bytes;
+    }
+
+    const uint8_t* end() const
+    {
+      return bytes + length;
+    }
+};
 
 struct midi_event
 {
-    std::chrono::nanoseconds time;
-    std::vector<uint8_t> data;
+    // since the beginning of the song. The tempo map of the song gives its
+    // song time.
+    uint64_t tick;
+    midi_message data;
 
     midi_event()
-      : time (std::numeric_limits<decltype(time)>::max())
+      : tick (std::numeric_limits<decltype(tick)>::max())
       , data ()
     {
     }
+
+    midi_event(decltype(midi_event::tick) init_tick,
+	       const decltype(midi_event::data)& init_data)
+      : tick (init_tick)
+      , data (init_data)
+    {
+    }
+};
+
+// how the tracks of a multiple track file get decoded
+enum track_decoding : bool
+{
+  sequential_decoding,
+  parallel_decoding, // one track per core at a time
 };
 
+// only returns the midi channel events, sysex and meta events are consumed by
+// the parsing itself: the tempo events make the tempo map of the song, which
+// converts the ticks of the events to song time.
 std::vector<struct midi_event>
-get_midi_events(const std::string& filename);
+get_midi_events(const std::string& filename, class tempo_map& tempo, enum track_decoding decoding = parallel_decoding);
+
+// reads the midi channel events of a file in tick order, one piece after the
+// other. Unlike get_midi_events, the events occuring after the requested time
+// are not decoded yet: a piece takes a time proportional to its own number of
+// events, whatever the file size.
+class midi_event_stream
+{
+  public:
+    explicit midi_event_stream(const std::string& filename);
+    ~midi_event_stream();
+
+    midi_event_stream(const midi_event_stream&) = delete;
+    midi_event_stream& operator=(const midi_event_stream&) = delete;
+
+    // appends the channel events occuring up to the given song time
+    // (included) to res. Returns false once all the events have been read.
+    bool read_until(std::chrono::nanoseconds song_time, std::vector<struct midi_event>& res);
+
+    // the tempo changes read so far: enough to give the song time of the
+    // events read
+    const class tempo_map& tempo() const __attribute__((pure));
+
+    // the identity of the midi file, see mapped_file::identify
+    bool identify(struct file_identity& res) const;
+
+  private:
+    struct impl;
+    std::unique_ptr<struct impl> p;
+};
 
 #endif /* MIDI_READER_HH_ */
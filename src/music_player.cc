@@ -3,37 +3,55 @@
 #include <stdexcept>
 #include <cerrno>
 #include <cstring>
-#include <signal.h> // for sig_atomic_t type
+#include <functional>
 #include <chrono>
+#include <string>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <pthread.h> // for pthread_setschedparam
+#include <sched.h>
+#include <sys/mman.h> // for mlockall
 #include "music_player.hh"
 #include "keyboard_events_extractor.hh"
-
-// Global variables to "share" state between the signal handler and
-// the main event loop.  Only these two pieces should be allowed to
-// use these global variables.  To avoid any other piece piece of code
-// from using it, the declaration is not written on a header file on
-// purpose.
-extern volatile sig_atomic_t pause_required;
-extern volatile sig_atomic_t continue_required;
-extern volatile sig_atomic_t exit_required;
-
+#include "spsc_ring.hh"
+#include "song_checkpoints.hh"
+#include "song_timeline.hh"
+#include "frame_keys_coalescer.hh"
+#include "playback_timing.hh"
+#include "playback_clock.hh"
+#include "midi_output.hh"
+#include "screen.hh"
+#include "event_loop.hh"
+#include "signals_handler.hh"
+
+template <typename cell_writer>
 static
-void draw_piano_key(int x, int y, int width, int height,  uint16_t color)
+void draw_piano_key(cell_writer& write, int x, int y, int width, int height,  uint16_t color)
 {
   for (int i = x; i < x + width; ++i)
   {
     for (int j = y; j < y + height; ++j)
     {
-      tb_change_cell(i, j, 0x2588, color, TB_DEFAULT);
+      write(i, j, 0x2588, color, TB_DEFAULT);
     }
   }
 }
 
-static void draw_separating_line(int x, int y, int height, uint16_t bg_color)
+template <typename cell_writer>
+static void draw_separating_line(cell_writer& write, int x, int y, int height, uint16_t bg_color)
 {
   for (int j = y; j < y + height; ++j)
   {
-    tb_change_cell(x, j, 0x2502, TB_BLACK, bg_color);
+    write(x, j, 0x2502, TB_BLACK, bg_color);
   }
 }
 
@@ -89,95 +107,85 @@ struct keys_color
     uint8_t do_8_color;
 };
 
+template <typename cell_writer>
 static
-void draw_octave(int x, int y, const struct octave_color& notes_color)
+void draw_octave(cell_writer& write, int x, int y, const struct octave_color& notes_color)
 {
-  draw_piano_key(x,     y, 3, 8, notes_color.do_color);  // do
-  draw_piano_key(x + 3, y, 4, 8, notes_color.re_color);  // re
-  draw_piano_key(x + 7, y, 3, 8, notes_color.mi_color);  // mi
+  draw_piano_key(write, x,     y, 3, 8, notes_color.do_color);  // do
+  draw_piano_key(write, x + 3, y, 4, 8, notes_color.re_color);  // re
+  draw_piano_key(write, x + 7, y, 3, 8, notes_color.mi_color);  // mi
 
-  draw_piano_key(x + 10, y, 4, 8, notes_color.fa_color); // fa
-  draw_piano_key(x + 14, y, 4, 8, notes_color.sol_color); // sol
-  draw_piano_key(x + 18, y, 3, 8, notes_color.la_color); // la
-  draw_piano_key(x + 21, y, 4, 8, notes_color.si_color); // si
+  draw_piano_key(write, x + 10, y, 4, 8, notes_color.fa_color); // fa
+  draw_piano_key(write, x + 14, y, 4, 8, notes_color.sol_color); // sol
+  draw_piano_key(write, x + 18, y, 3, 8, notes_color.la_color); // la
+  draw_piano_key(write, x + 21, y, 4, 8, notes_color.si_color); // si
 
-  draw_piano_key(x + 2, y, 2, 5, notes_color.do_diese_color);  // do#
-  draw_piano_key(x + 6, y, 2, 5, notes_color.re_diese_color);  // re#
+  draw_piano_key(write, x + 2, y, 2, 5, notes_color.do_diese_color);  // do#
+  draw_piano_key(write, x + 6, y, 2, 5, notes_color.re_diese_color);  // re#
 
-  draw_separating_line(x + 3, y + 5, 3, notes_color.do_color); // between do and re
-  draw_separating_line(x + 6, y + 5, 3, notes_color.re_color); // between re and mi
+  draw_separating_line(write, x + 3, y + 5, 3, notes_color.do_color); // between do and re
+  draw_separating_line(write, x + 6, y + 5, 3, notes_color.re_color); // between re and mi
 
-  draw_piano_key(x + 13, y, 2, 5, notes_color.fa_diese_color); // fa#
-  draw_piano_key(x + 17, y, 2, 5, notes_color.sol_diese_color); // sol#
-  draw_piano_key(x + 21, y, 2, 5, notes_color.la_diese_color); // la#
+  draw_piano_key(write, x + 13, y, 2, 5, notes_color.fa_diese_color); // fa#
+  draw_piano_key(write, x + 17, y, 2, 5, notes_color.sol_diese_color); // sol#
+  draw_piano_key(write, x + 21, y, 2, 5, notes_color.la_diese_color); // la#
 
-  draw_separating_line(x + 14, y + 5, 3, notes_color.fa_color); // between fa and sol
-  draw_separating_line(x + 18, y + 5, 3, notes_color.sol_color); // between sol and la
-  draw_separating_line(x + 21, y + 5, 3, notes_color.la_color); // between la and si
+  draw_separating_line(write, x + 14, y + 5, 3, notes_color.fa_color); // between fa and sol
+  draw_separating_line(write, x + 18, y + 5, 3, notes_color.sol_color); // between sol and la
+  draw_separating_line(write, x + 21, y + 5, 3, notes_color.la_color); // between la and si
 
-  draw_separating_line(x + 10, y, 8, notes_color.mi_color); // between mi and fa
+  draw_separating_line(write, x + 10, y, 8, notes_color.mi_color); // between mi and fa
 
 }
 
-static void draw_keyboard(const struct keys_color& keyboard, int pos_x, int pos_y)
+template <typename cell_writer>
+static void draw_keyboard(cell_writer& write, const struct keys_color& keyboard, int pos_x, int pos_y)
 {
-  draw_piano_key(pos_x + 1, pos_y, 3, 8, keyboard.la_0_color); // la 0
-  draw_piano_key(pos_x + 4, pos_y, 4, 8, keyboard.si_0_color); // si 0
-  draw_piano_key(pos_x + 4, pos_y, 2, 5, keyboard.la_diese_0_color); // la# 0
-  draw_separating_line(pos_x + 4, pos_y + 5, 3, keyboard.la_0_color); // between la0 and si0
+  draw_piano_key(write, pos_x + 1, pos_y, 3, 8, keyboard.la_0_color); // la 0
+  draw_piano_key(write, pos_x + 4, pos_y, 4, 8, keyboard.si_0_color); // si 0
+  draw_piano_key(write, pos_x + 4, pos_y, 2, 5, keyboard.la_diese_0_color); // la# 0
+  draw_separating_line(write, pos_x + 4, pos_y + 5, 3, keyboard.la_0_color); // between la0 and si0
 
   for (int i = 0; i < 7; ++i)
   {
-    draw_octave(pos_x + 8 + (25 * i), pos_y, (keyboard.octaves[i]));
+    draw_octave(write, pos_x + 8 + (25 * i), pos_y, (keyboard.octaves[i]));
   }
 
-  draw_piano_key(pos_x + 8 + (25 * 7), pos_y, 4, 8, keyboard.do_8_color); // do 8
+  draw_piano_key(write, pos_x + 8 + (25 * 7), pos_y, 4, 8, keyboard.do_8_color); // do 8
 
   for (int i = 0; i < 7; ++i)
   {
-    draw_separating_line(pos_x + 8 + (25 * (i + 1)), pos_y, 8, keyboard.octaves[i].si_color); // between octaves
+    draw_separating_line(write, pos_x + 8 + (25 * (i + 1)), pos_y, 8, keyboard.octaves[i].si_color); // between octaves
   }
-  draw_separating_line(pos_x + 8 + (25 * 0), pos_y, 8, keyboard.si_0_color);
+  draw_separating_line(write, pos_x + 8 + (25 * 0), pos_y, 8, keyboard.si_0_color);
 }
 
 
 #define OCTAVE_COLOR(X)						\
   case note_kind::do_##X:					\
-  keyboard.octaves[(X - 1)].do_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].do_color;			\
   case note_kind::do_diese##X:					\
-  keyboard.octaves[(X - 1)].do_diese_color = diese_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].do_diese_color;		\
   case note_kind::re_##X:					\
-  keyboard.octaves[(X - 1)].re_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].re_color;			\
   case note_kind::re_diese_##X:					\
-  keyboard.octaves[(X - 1)].re_diese_color = diese_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].re_diese_color;		\
   case note_kind::mi_##X:					\
-  keyboard.octaves[(X - 1)].mi_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].mi_color;			\
   case note_kind::fa_##X:					\
-  keyboard.octaves[(X - 1)].fa_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].fa_color;			\
   case note_kind::fa_diese_##X:					\
-  keyboard.octaves[(X - 1)].fa_diese_color = diese_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].fa_diese_color;		\
   case note_kind::sol_##X:					\
-  keyboard.octaves[(X - 1)].sol_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].sol_color;			\
   case note_kind::sol_diese_##X:				\
-  keyboard.octaves[(X - 1)].sol_diese_color = diese_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].sol_diese_color;		\
   case note_kind::la_##X:					\
-  keyboard.octaves[(X - 1)].la_color = normal_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].la_color;			\
   case note_kind::la_diese_##X:					\
-  keyboard.octaves[(X - 1)].la_diese_color = diese_key_color;	\
-  break;							\
+  return &keyboard.octaves[(X - 1)].la_diese_color;		\
   case note_kind::si_##X:					\
-  keyboard.octaves[(X - 1)].si_color = normal_key_color;	\
-  break								\
+  return &keyboard.octaves[(X - 1)].si_color			\
 
 
 #if defined(__clang__)
@@ -189,21 +197,20 @@ static void draw_keyboard(const struct keys_color& keyboard, int pos_x, int pos_
   #pragma clang diagnostic ignored "-Wcovered-switch-default"
 #endif
 
-static void set_color(struct keys_color& keyboard, enum note_kind note, uint8_t normal_key_color, uint8_t diese_key_color)
+// returns where the colour of a key is stored, or nullptr if the key is not
+// on a 88 key piano.
+static uint8_t* color_of(struct keys_color& keyboard, enum note_kind note)
 {
   switch (note)
   {
     case note_kind::la_0:
-      keyboard.la_0_color = normal_key_color;
-      break;
+      return &keyboard.la_0_color;
 
     case note_kind::la_diese_0:
-      keyboard.la_diese_0_color = diese_key_color;
-      break;
+      return &keyboard.la_diese_0_color;
 
     case note_kind::si_0:
-      keyboard.si_0_color = normal_key_color;
-      break;
+      return &keyboard.si_0_color;
 
       OCTAVE_COLOR(1);
       OCTAVE_COLOR(2);
@@ -214,13 +221,10 @@ static void set_color(struct keys_color& keyboard, enum note_kind note, uint8_t
       OCTAVE_COLOR(7);
 
     case note_kind::do_8:
-      keyboard.do_8_color = normal_key_color;
-      break;
+      return &keyboard.do_8_color;
 
     default:
-      std::cerr << "Warning key " << static_cast<long unsigned int>(note)
-		<< " is not representable in a 88 key piano" << std::endl;
-      break;
+      return nullptr;
   }
 }
 #if defined(__clang__)
@@ -229,6 +233,40 @@ static void set_color(struct keys_color& keyboard, enum note_kind note, uint8_t
 
 #undef OCTAVE_COLOR
 
+static const uint8_t* color_of(const struct keys_color& keyboard, enum note_kind note)
+{
+  return color_of(const_cast<struct keys_color&>(keyboard), note);
+}
+
+static bool is_diese(enum note_kind note)
+{
+  switch (static_cast<uint8_t>(note) % 12)
+  {
+    case 1: // do#
+    case 3: // re#
+    case 6: // fa#
+    case 8: // sol#
+    case 10: // la#
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static void set_color(struct keys_color& keyboard, enum note_kind note, uint8_t normal_key_color, uint8_t diese_key_color)
+{
+  const auto color = color_of(keyboard, note);
+  if (color == nullptr)
+  {
+    std::cerr << "Warning key " << static_cast<long unsigned int>(note)
+	      << " is not representable in a 88 key piano" << std::endl;
+    return;
+  }
+
+  *color = is_diese(note) ? diese_key_color : normal_key_color;
+}
+
 static void set_color(struct keys_color& keyboard, enum note_kind note)
 {
   set_color(keyboard, note, TB_BLUE, TB_CYAN);
@@ -241,16 +279,15 @@ static void reset_color(struct keys_color& keyboard, enum note_kind note)
 
 
 
-template <typename T>
 static
-void init_sound(T& player, unsigned int midi_port)
+void init_input(RtMidiIn& listener, unsigned int midi_port)
 {
 
-  player.openPort(midi_port);
+  listener.openPort(midi_port);
 
-  if (!player.isPortOpen())
+  if (!listener.isPortOpen())
   {
-    throw std::runtime_error("Error while initialising the sound system: couldn't open output sound port");
+    throw std::runtime_error("Error while initialising the sound system: couldn't open input sound port");
   }
 }
 
@@ -275,7 +312,8 @@ void init_termbox()
   }
 }
 
-static void update_keyboard(struct keys_color& keyboard, const std::vector<key_data>& key_events)
+template <typename key_events_t>
+static void update_keyboard(struct keys_color& keyboard, const key_events_t& key_events)
 {
       /* update the keyboard */
     for (const auto& k_ev : key_events)
@@ -303,184 +341,1016 @@ static void update_keyboard(struct keys_color& keyboard, const std::vector<key_d
 
 
 // following function was copy/pasted from the termbox computer keyboard example
-static void print_tb(const char *str, int x, int y, uint16_t fg, uint16_t bg)
+static void print_tb(class screen& out, const char *str, int x, int y, uint16_t fg, uint16_t bg)
 {
   while (*str) {
     uint32_t uni;
     str += tb_utf8_char_to_unicode(&uni, str);
-    tb_change_cell(x, y, uni, fg, bg);
+    out.change_cell(x, y, uni, fg, bg);
     x++;
   }
 }
 
-static void update_screen(const struct keys_color& keyboard, const int ref_x, const int ref_y)
+static void draw_keyboard(class screen& out, const struct keys_color& keyboard, int pos_x, int pos_y)
 {
+  auto write = [&out] (int x, int y, uint32_t ch, uint16_t fg, uint16_t bg) { out.change_cell(x, y, ch, fg, bg); };
+  draw_keyboard(write, keyboard, pos_x, pos_y);
+}
 
-    /* draw keyboard */
-    tb_clear();
-    draw_keyboard(keyboard, ref_x, ref_y);
+static void draw_help(class screen& out, const int ref_x, const int ref_y)
+{
+    print_tb(out, "press <CTRL + q> to quit", ref_x, ref_y + 10, TB_MAGENTA, TB_DEFAULT);
+    print_tb(out, "press <space> to pause/unpause", ref_x, ref_y + 11, TB_MAGENTA, TB_DEFAULT);
+    print_tb(out, "press <left>/<right> to go 5s backward/forward", ref_x, ref_y + 12, TB_MAGENTA, TB_DEFAULT);
+    print_tb(out, "press <up>/<down> to play faster/slower", ref_x, ref_y + 13, TB_MAGENTA, TB_DEFAULT);
+    print_tb(out, "press <t> to show how late the notes are played", ref_x, ref_y + 14, TB_MAGENTA, TB_DEFAULT);
+}
 
-    print_tb("press <CTRL + q> to quit", ref_x, ref_y + 10, TB_MAGENTA, TB_DEFAULT);
-    print_tb("press <space> to pause/unpause", ref_x, ref_y + 11, TB_MAGENTA, TB_DEFAULT);
 
-    tb_present();
+/* size of the keyboard once drawn */
+constexpr const int keyboard_height = 8;
+constexpr const int keyboard_width = 188;
 
-}
+// draws the keyboard in memory instead of on the terminal, its top left
+// corner being at 0,0.
+struct offscreen_keyboard
+{
+    struct cell
+    {
+	uint32_t ch;
+	uint16_t fg;
+	uint16_t bg;
+    };
 
+    offscreen_keyboard()
+      : cells ()
+    {
+    }
 
-static void play_music(RtMidiOut& sound_player, const std::vector<midi_message>& midi_messages)
+    void operator()(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg)
+    {
+      // negative positions become huge once unsigned
+      const auto col = static_cast<unsigned int>(x);
+      const auto row = static_cast<unsigned int>(y);
+      if ((col < keyboard_width) and (row < keyboard_height))
+      {
+	cells[row * keyboard_width + col] = { ch, fg, bg };
+      }
+    }
+
+    std::array<struct cell, keyboard_width * keyboard_height> cells;
+};
+
+// draws the keyboard incrementally: only the cells of the keys whose colour
+// changed since the previous frame are written to the terminal. The whole
+// screen is only drawn again when the terminal is resized.
+class keyboard_renderer
+{
+  public:
+    explicit keyboard_renderer(class screen& init_out)
+      : out (init_out)
+      , cells ()
+      , first_cell_of_key ()
+      , shown ()
+      , ref_x (0)
+      , ref_y (0)
+      , status ()
+    {
+      compute_layout();
+    }
+
+    void redraw(const struct keys_color& keyboard, const int new_ref_x, const int new_ref_y)
+    {
+      ref_x = new_ref_x;
+      ref_y = new_ref_y;
+      shown = keyboard;
+
+      out.clear();
+      draw_keyboard(out, keyboard, ref_x, ref_y);
+      draw_help(out, ref_x, ref_y);
+      print_tb(out, status.c_str(), ref_x, ref_y + status_line, TB_MAGENTA, TB_DEFAULT);
+      out.present();
+    }
+
+    // a line of text shown below the help, e.g. the playing speed
+    void set_status(const std::string& new_status)
+    {
+      print_tb(out, std::string(status.size(), ' ').c_str(), ref_x, ref_y + status_line, TB_DEFAULT, TB_DEFAULT);
+      status = new_status;
+      print_tb(out, status.c_str(), ref_x, ref_y + status_line, TB_MAGENTA, TB_DEFAULT);
+      out.present();
+    }
+
+    void update(const struct keys_color& keyboard)
+    {
+      bool has_changed = false;
+
+      for (unsigned int note = note_kind::la_0; note <= note_kind::do_8; ++note)
+      {
+	const auto color = *color_of(keyboard, static_cast<enum note_kind>(note));
+	if (color == *color_of(shown, static_cast<enum note_kind>(note)))
+	{
+	  continue;
+	}
+
+	for (auto i = first_cell_of_key[note]; i < first_cell_of_key[note + 1]; ++i)
+	{
+	  const auto& cell = cells[i];
+	  out.change_cell(ref_x + cell.x, ref_y + cell.y, cell.ch,
+			 cell.fg_is_key_color ? color : cell.fg,
+			 cell.bg_is_key_color ? color : cell.bg);
+	}
+
+	has_changed = true;
+      }
+
+      if (has_changed)
+      {
+	shown = keyboard;
+	out.present();
+      }
+    }
+
+  private:
+    // a cell belonging to a key, relative to the top left corner of the
+    // keyboard.
+    struct key_cell
+    {
+	int x;
+	int y;
+	uint32_t ch;
+	uint16_t fg;
+	uint16_t bg;
+	bool fg_is_key_color;
+	bool bg_is_key_color;
+    };
+
+    // the cells of a key are the ones which look different once the key is
+    // pressed. The keyboard drawing code stays the only one knowing what a
+    // key looks like.
+    void compute_layout()
+    {
+      const struct keys_color released;
+      offscreen_keyboard released_view;
+      draw_keyboard(released_view, released, 0, 0);
+
+      for (unsigned int note = 0; note < first_cell_of_key.size(); ++note)
+      {
+	first_cell_of_key[note] = cells.size();
+
+	if ((note < note_kind::la_0) or (note > note_kind::do_8))
+	{
+	  continue;
+	}
+
+	struct keys_color pressed = released;
+	set_color(pressed, static_cast<enum note_kind>(note));
+
+	offscreen_keyboard pressed_view;
+	draw_keyboard(pressed_view, pressed, 0, 0);
+
+	for (std::size_t i = 0; i < pressed_view.cells.size(); ++i)
+	{
+	  const auto& before = released_view.cells[i];
+	  const auto& after = pressed_view.cells[i];
+	  if ((before.fg != after.fg) or (before.bg != after.bg))
+	  {
+	    const auto pos = static_cast<int>(i);
+	    cells.push_back({ pos % keyboard_width, pos / keyboard_width, after.ch,
+			      after.fg, after.bg,
+			      before.fg != after.fg, before.bg != after.bg });
+	  }
+	}
+      }
+    }
+
+    class screen& out;
+    std::vector<struct key_cell> cells;
+    std::array<std::size_t, 129> first_cell_of_key; // cells of the key n are [first_cell_of_key[n], first_cell_of_key[n + 1])
+    static constexpr const int status_line = 15; // below the help
+
+    struct keys_color shown; // what is on screen
+    int ref_x;
+    int ref_y;
+    std::string status;
+};
+
+static void play_music(midi_output& output, const array_view<midi_message>& midi_messages, std::chrono::nanoseconds deadline)
 {
   // play the music
-  for (const auto& message : midi_messages)
-  {
-    auto tmp = message; // can't use message directly since message is const and
-			// sendMessage doesn't take a const vector
-    sound_player.sendMessage(&tmp);
-
-    // could use the following to cast the const away: but since there is no
-    // guarantee that the libRtMidi doesn't modify the data ... (I know the I
-    // can read the code)
-    //
-    //sound_player.sendMessage(const_cast<midi_message*>(&message));
-  }
+  output.send_all(midi_messages, deadline);
 }
 
 static
 void init_ref_pos(int& ref_x, int& ref_y, int width, int height)
 {
   /* to center the keyboard on the window */
-  const auto keyboard_height = 8;
-  const auto keyboard_width = 188;
   ref_x = (width - keyboard_width) / 2;
   ref_y = (height - keyboard_height ) / 2;
 }
 
 static
-void init_ref_pos(int& ref_x, int& ref_y)
+void init_ref_pos(int& ref_x, int& ref_y, class screen& out)
 {
-  init_ref_pos(ref_x, ref_y, tb_width(), tb_height());
+  init_ref_pos(ref_x, ref_y, out.width(), out.height());
 }
 
-void play(const std::vector<struct music_event>& music, unsigned int midi_output_port)
+// sends what is needed to go from a playback state to another: the notes
+// which must no longer sound are stopped, the instruments are changed, then
+// the notes which must sound are started.
+static void play_transition(midi_output& output, const struct playback_state& from, const struct playback_state& to,
+			    std::chrono::nanoseconds time)
 {
-  RtMidiOut sound_player (RtMidi::LINUX_ALSA);
+  for (unsigned int channel = 0; channel < to.velocities.size(); ++channel)
+  {
+    const auto status = static_cast<uint8_t>(channel);
+    for (unsigned int pitch = 0; pitch < to.velocities[channel].size(); ++pitch)
+    {
+      if ((from.velocities[channel][pitch] != 0) and (to.velocities[channel][pitch] == 0))
+      {
+	const uint8_t message[] = { static_cast<uint8_t>(0x80 | status), static_cast<uint8_t>(pitch), 0 };
+	output.send(message, sizeof(message), time);
+      }
+    }
 
-  init_sound(sound_player, midi_output_port);
-  SCOPE_EXIT_BY_REF(sound_player.closePort());
+    if (to.has_program[channel] and
+	((not from.has_program[channel]) or (from.programs[channel] != to.programs[channel])))
+    {
+      const uint8_t message[] = { static_cast<uint8_t>(0xC0 | status), to.programs[channel] };
+      output.send(message, sizeof(message), time);
+    }
 
-  init_termbox();
-  SCOPE_EXIT(tb_shutdown());
+    for (unsigned int pitch = 0; pitch < to.velocities[channel].size(); ++pitch)
+    {
+      if ((from.velocities[channel][pitch] == 0) and (to.velocities[channel][pitch] != 0))
+      {
+	const uint8_t message[] = { static_cast<uint8_t>(0x90 | status), static_cast<uint8_t>(pitch), to.velocities[channel][pitch] };
+	output.send(message, sizeof(message), time);
+      }
+    }
+  }
+}
 
-  struct keys_color keyboard;
+// sends the midi messages of a song from its own thread, so that drawing
+// on a slow terminal (or over ssh) never delays the sound. The key events
+// of the played music events are handed over to the UI thread through a
+// lock-free ring: the UI may be late, the sound stays on time.
+//
+// keys_played is called by the midi thread once it pushed key events in
+// the ring, and once it finished, so that the UI doesn't have to poll.
+class midi_player
+{
+  public:
+    midi_player(song_loader& init_loader, midi_output& init_output, key_events_ring& init_played_keys,
+		playback_timing& init_timing, playback_clock& init_clock, const std::function<void()>& init_keys_played)
+      : loader (init_loader)
+      , music ()
+      , output (init_output)
+      , played_keys (init_played_keys)
+      , timing (init_timing)
+      , clock (init_clock)
+      , keys_played (init_keys_played)
+      , checkpoints (music)
+      , state ()
+      , next_event (0)
+      , mutex ()
+      , wake_up ()
+      , timeline ()
+      , stop_required (false)
+      , seek_required (false)
+      , seek_target (0)
+      , finished (false)
+      , error ()
+      , thread ()
+    {
+    }
 
-  int ref_x;
-  int ref_y;
-  init_ref_pos(ref_x, ref_y);
+    midi_player(const midi_player&) = delete;
+    midi_player& operator=(const midi_player&) = delete;
 
+    ~midi_player()
+    {
+      stop();
+    }
 
-  /* start playing the events */
-  const auto nb_events = music.size();
-  for (unsigned i = 0; i < nb_events; ++i)
-  {
-    const auto& current_event = music[i];
+    // starts playing the song from the given song time. Returns false if
+    // the real-time priority was requested but couldn't be set (the song
+    // is played anyway).
+    bool start(std::chrono::nanoseconds start_at, bool realtime)
+    {
+      timeline = { std::chrono::nanoseconds{ 0 },
+		   false,
+		   std::chrono::nanoseconds{ 0 },
+		   100 };
+
+      // the rest of the song is loaded while it is played
+      load_until(start_at);
+
+      if (start_at.count() <= 0)
+      {
+	// the first event is played right away
+	if (not music.events.empty())
+	{
+	  timeline.move_to(music.events.front().time, clock.now());
+	}
+      }
+      else
+      {
+	seek(start_at);
+      }
 
-    update_keyboard(keyboard, current_event.key_events);
-    update_screen(keyboard, ref_x, ref_y);
-    play_music(sound_player, current_event.midi_messages);
+      thread = std::thread(&midi_player::run, this);
 
-    if (i != nb_events - 1)
+      return (not realtime) or set_realtime_priority(thread);
+    }
+
+    void stop()
     {
-      // sleep until next music event or a key (== space or ctrl+q) is pressed
-      const auto time_to_wait = (music[i + 1].time - current_event.time); // sleep time is in nanoseconds
-      std::chrono::nanoseconds waited_time { 0 };
+      {
+	std::lock_guard<std::mutex> lock (mutex);
+	stop_required = true;
+      }
+      wake_up.notify_all();
+
+      // the midi thread may be waiting for the next piece of the song
+      loader.stop_waiting();
 
-      struct timespec timeval;
-      auto status = clock_gettime(CLOCK_MONOTONIC, &timeval);
-      if (status == -1)
+      if (thread.joinable())
       {
-	std::cerr << std::strerror(errno) << "\n";
-	return;
+	thread.join();
       }
+    }
 
-      const std::chrono::steady_clock::time_point started_time = std::chrono::steady_clock::now();
+    void pause()
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      timeline.pause(clock.now());
+    }
 
-      bool is_in_pause = false;
+    void resume()
+    {
+      {
+	std::lock_guard<std::mutex> lock (mutex);
+	timeline.resume(clock.now());
+      }
+      wake_up.notify_all();
+    }
 
-      do
+    void toggle_pause()
+    {
       {
-	struct tb_event tmp;
-	const auto timeout = (time_to_wait > waited_time)
-	  ? std::min(static_cast<std::chrono::milliseconds::rep>(100), std::chrono::duration_cast<std::chrono::milliseconds>(time_to_wait - waited_time).count())
-	  : 100;
-	auto ret_val = tb_peek_event(&tmp, static_cast<int>(timeout)); // timeout in ms
-	switch (ret_val)
+	std::lock_guard<std::mutex> lock (mutex);
+	if (timeline.is_paused)
 	{
-	  case TB_EVENT_KEY:
-	    switch (tmp.key)
-	    {
-	      case TB_KEY_CTRL_Q:
-		return; // ctrl + q means quit
+	  timeline.resume(clock.now());
+	}
+	else
+	{
+	  timeline.pause(clock.now());
+	}
+      }
+      wake_up.notify_all();
+    }
 
-	      case TB_KEY_SPACE:
-		is_in_pause = (not is_in_pause); // toggle pause
-		break;
+    // moves forward (or backward, if negative) in the song. The seek itself
+    // is done by the midi thread.
+    void seek_by(std::chrono::nanoseconds offset)
+    {
+      {
+	std::lock_guard<std::mutex> lock (mutex);
+	// seeks requested in a row add up, even if the midi thread didn't
+	// handle the previous one yet.
+	const auto from = seek_required ? seek_target : timeline.song_time_at(clock.now());
+	const auto target = from + offset;
+	seek_target = std::max(target, std::chrono::nanoseconds{ 0 });
+	seek_required = true;
+      }
+      wake_up.notify_all();
+    }
 
-	      default:
-		break;
-	    }
-	    break;
+    // plays the song faster (or slower, if negative) by the given number of
+    // steps. Returns the new speed, in percents.
+    unsigned int change_speed(int nb_steps)
+    {
+      // finer steps around the normal speed, where one practices a piece
+      static constexpr const std::array<unsigned int, 16> speeds = { { 25, 33, 50, 67, 75, 80, 85, 90, 95,
+									100, 110, 125, 150, 200, 300, 400 } };
+      unsigned int res;
+      {
+	std::lock_guard<std::mutex> lock (mutex);
+
+	const auto current = std::lower_bound(speeds.begin(), speeds.end(), timeline.speed) - speeds.begin();
+	const auto wanted = std::min(std::max(current + nb_steps, decltype(current){ 0 }),
+				     static_cast<decltype(current)>(speeds.size() - 1));
 
-	  case TB_EVENT_RESIZE:
-	    init_ref_pos(ref_x, ref_y, tmp.w, tmp.h);
-	    break;
+	res = speeds[static_cast<std::size_t>(wanted)];
+	timeline.set_speed(res, clock.now());
+      }
+      wake_up.notify_all();
+
+      return res;
+    }
+
+    // true once the last music event has been played (or playing failed)
+    bool is_finished() const
+    {
+      return finished;
+    }
 
-	  default:
-	    break;
+    // forwards the error the midi thread stopped on, if any. Only meaningful
+    // once is_finished() returned true.
+    void rethrow_error() const
+    {
+      if (error)
+      {
+	std::rethrow_exception(error);
+      }
+    }
+
+  private:
+    enum class wake_up_reason
+    {
+      event_due,
+      seek,
+      stop,
+    };
+
+    // the midi thread is the one that must never be late: let it preempt
+    // everything else, when allowed to.
+    static bool set_realtime_priority(std::thread& midi_thread)
+    {
+      const auto min_priority = sched_get_priority_min(SCHED_FIFO);
+      const auto max_priority = sched_get_priority_max(SCHED_FIFO);
+      if ((min_priority == -1) or (max_priority == -1))
+      {
+	return false;
+      }
+
+      struct sched_param param;
+      std::memset(&param, 0, sizeof(param));
+      param.sched_priority = (min_priority + max_priority) / 2;
+
+      return pthread_setschedparam(midi_thread.native_handle(), SCHED_FIFO, &param) == 0;
+    }
+
+    // waits until the song reaches the given song time, or until a seek or
+    // stop is requested.
+    enum wake_up_reason wait_for(std::unique_lock<std::mutex>& lock, std::chrono::nanoseconds song_time)
+    {
+      for (;;)
+      {
+	if (stop_required)
+	{
+	  return wake_up_reason::stop;
+	}
+
+	if (seek_required)
+	{
+	  return wake_up_reason::seek;
+	}
+
+	if (timeline.is_paused)
+	{
+	  wake_up.wait(lock);
+	  continue;
+	}
+
+	const auto deadline = timeline.deadline_of(song_time);
+	if (deadline <= clock.now())
+	{
+	  return wake_up_reason::event_due;
 	}
 
-	if (exit_required)
+	// check again once woken up: the song might have been stopped,
+	// paused, moved or sped up meanwhile
+	clock.wait_until(lock, wake_up, deadline, [&] () {
+	    return stop_required or seek_required or timeline.is_paused or
+	      (timeline.deadline_of(song_time) != deadline);
+	  });
+      }
+    }
+
+    // waits for the next piece of the song, and appends it. Returns false
+    // if the whole song has been loaded already, or if the player is being
+    // stopped.
+    bool load_next_piece()
+    {
+      struct song piece;
+      if (not loader.next_piece(piece))
+      {
+	return false;
+      }
+
+      if (music.events.empty())
+      {
+	// saves copying a song given in one piece
+	music = std::move(piece);
+      }
+      else
+      {
+	append_song(music, piece);
+      }
+      checkpoints.extend();
+      return true;
+    }
+
+    // waits until the song is loaded up to the given song time (included),
+    // or entirely.
+    void load_until(std::chrono::nanoseconds song_time)
+    {
+      while (music.events.empty() or (music.events.back().time < song_time))
+      {
+	if (not load_next_piece())
 	{
 	  return;
 	}
+      }
+    }
+
+    // appends the pieces of the song loaded so far, without waiting
+    void take_loaded_pieces()
+    {
+      struct song piece;
+      while (loader.next_piece(piece, std::chrono::milliseconds{ 0 }))
+      {
+	append_song(music, piece);
+	checkpoints.extend();
+      }
+    }
+
+    // continues the song from the given song time. The notes and keys are
+    // set as if the song had been played up to there, starting from the
+    // closest checkpoint, so it takes the same time wherever the target is.
+    void seek(std::chrono::nanoseconds song_time)
+    {
+      next_event = checkpoints.event_at(song_time);
+
+      const auto target_state = checkpoints.state_before(next_event);
+      play_transition(output, state, target_state, clock.now());
 
-	if (pause_required)
+      for (unsigned int pitch = 0; pitch < target_state.pressed_keys.size(); ++pitch)
+      {
+	if (state.pressed_keys[pitch] != target_state.pressed_keys[pitch])
 	{
-	  pause_required = 0;
-	  is_in_pause = true;
+	  played_keys.push({ static_cast<uint8_t>(pitch),
+			     target_state.pressed_keys[pitch] ? key_data::type::pressed : key_data::type::released });
 	}
+      }
+      keys_played();
+
+      state = target_state;
+      timeline.move_to(song_time, clock.now());
+    }
 
-	if (continue_required)
+    void run()
+    {
+      SCOPE_EXIT_BY_REF(clock.leave(); keys_played());
+
+      try
+      {
+	std::unique_lock<std::mutex> lock (mutex);
+
+	for (;;)
 	{
-	  continue_required = 0;
-	  is_in_pause = false;
+	  if (next_event == music.events.size())
+	  {
+	    // the player caught up with the loading (or the song is over)
+	    lock.unlock();
+	    const bool has_more = load_next_piece();
+	    lock.lock();
+
+	    if (not has_more)
+	    {
+	      break;
+	    }
+	    continue;
+	  }
+
+	  const auto& current_event = music.events[next_event];
+
+	  switch (wait_for(lock, current_event.time))
+	  {
+	    case wake_up_reason::stop:
+	      finished = true;
+	      return;
+
+	    case wake_up_reason::seek:
+	    {
+	      const auto target = seek_target;
+
+	      lock.unlock();
+	      load_until(target);
+	      lock.lock();
+
+	      // a further seek might have been requested while loading
+	      if (seek_target == target)
+	      {
+		seek_required = false;
+		seek(target);
+	      }
+	      continue;
+	    }
+
+	    case wake_up_reason::event_due:
+	      break;
+
+#if !defined(__clang__)
+// clang complains that all values are handled in the switch and issue
+// a warning for the default case
+// gcc complains about a missing default
+	    default:
+	      __builtin_unreachable();
+#endif
+	  }
+
+	  const auto deadline = timeline.deadline_of(current_event.time);
+	  lock.unlock();
+
+	  const auto messages = music.midi_messages_of(current_event);
+	  const auto send_start = clock.now();
+	  play_music(output, messages, deadline);
+	  const auto send_end = clock.now();
+
+	  timing.record({ current_event.time, deadline, send_start, send_end, static_cast<uint32_t>(messages.size()) });
+
+	  const auto keys = music.key_events_of(current_event);
+	  for (const auto& key : keys)
+	  {
+	    // if the UI is that late, the key is simply not shown.
+	    played_keys.push(key);
+	  }
+
+	  if (not keys.empty())
+	  {
+	    keys_played();
+	  }
+
+	  state.apply(music, current_event);
+
+	  // current_event is invalidated from here
+	  take_loaded_pieces();
+
+	  lock.lock();
+	  ++next_event;
 	}
+      }
+      catch (...)
+      {
+	error = std::current_exception();
+      }
+
+      finished = true;
+    }
+
+    song_loader& loader;
+
+    // only used by the midi thread (or before it starts)
+    struct song music; // the part loaded so far
+    midi_output& output;
+    key_events_ring& played_keys;
+    playback_timing& timing;
+    playback_clock& clock;
+    std::function<void()> keys_played;
+    song_checkpoints checkpoints;
+    struct playback_state state; // what has been played so far
+    std::size_t next_event;
+
+    std::mutex mutex; // protects what follows, up to finished
+    std::condition_variable wake_up;
+    struct song_timeline timeline;
+    bool stop_required;
+    bool seek_required;
+    std::chrono::nanoseconds seek_target;
+
+    std::atomic<bool> finished;
+    std::exception_ptr error; // written by the midi thread before finished is set
+    std::thread thread;
+};
+
+// shows the keys played by the midi thread since the previous frame.
+// Returns true once the whole song has been played.
+static bool draw_frame(midi_player& player, key_events_ring& played_keys, frame_keys_coalescer& coalescer,
+		       std::vector<struct key_data>& frame_keys, struct keys_color& keyboard, keyboard_renderer& renderer)
+{
+  // must be read before draining the ring, otherwise the last key events
+  // could be missed.
+  const bool is_finished = player.is_finished();
 
-	status = clock_gettime(CLOCK_MONOTONIC, &timeval);
-	if (status == -1)
+  coalescer.next_frame(played_keys, frame_keys);
+  if (not frame_keys.empty())
+  {
+    update_keyboard(keyboard, frame_keys);
+    renderer.update(keyboard);
+  }
+
+  if (is_finished)
+  {
+    player.rethrow_error();
+  }
+  return is_finished;
+}
+
+// prints the timing of the music events, and writes them as CSV, as the
+// options require.
+static void report_timing(const playback_timing& timing, const struct player_options& options, std::string& warnings)
+{
+  if (options.print_timing)
+  {
+    timing.print_report(std::cout);
+  }
+
+  if (not options.timing_csv.empty())
+  {
+    std::ofstream csv (options.timing_csv);
+    timing.write_csv(csv);
+    csv.close();
+    if (not csv)
+    {
+      warnings += "Warning: couldn't write the timing of the music events to " + options.timing_csv + "\n";
+    }
+  }
+}
+
+void play(song_loader& loader, midi_output& output, const struct player_options& options)
+{
+  // printed once termbox is shut down, so that they can actually be read
+  std::string warnings;
+  SCOPE_EXIT_BY_REF(std::cerr << warnings);
+
+  // reported once the midi thread stopped, and termbox is shut down
+  playback_timing timing (not options.timing_csv.empty());
+  SCOPE_EXIT_BY_REF(report_timing(timing, options, warnings));
+
+  if (options.realtime and (mlockall(MCL_CURRENT | MCL_FUTURE) == -1))
+  {
+    warnings += std::string{"Warning: couldn't lock the memory of the process: "} + std::strerror(errno) + "\n";
+  }
+
+  init_termbox();
+  SCOPE_EXIT(tb_shutdown());
+  termbox_screen terminal;
+
+  struct keys_color keyboard;
+
+  int ref_x;
+  int ref_y;
+  init_ref_pos(ref_x, ref_y, terminal);
+
+  keyboard_renderer renderer (terminal);
+  renderer.redraw(keyboard, ref_x, ref_y);
+
+  key_events_ring played_keys;
+  frame_keys_coalescer coalescer;
+  std::vector<struct key_data> frame_keys;
+
+  monotonic_clock clock;
+  event_loop loop;
+  midi_player player (loader, output, played_keys, timing, clock, [&loop] { loop.wake_up(); });
+  if (not player.start(options.start_at, options.realtime))
+  {
+    warnings += "Warning: couldn't give a real-time priority to the midi output thread\n";
+  }
+
+  // the UI only has to show what the midi thread already played, at most
+  // options.fps times per second, and handle the user inputs. It sleeps
+  // until one of them happens.
+  const auto frame_period = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds{ 1 }) / options.fps;
+  auto next_frame = clock.now();
+  bool is_frame_pending = true;
+
+  constexpr const std::chrono::seconds seek_step { 5 };
+
+  struct loop_events events;
+  for (;;)
+  {
+    if (is_frame_pending)
+    {
+      const auto now = clock.now();
+      if (now >= next_frame)
+      {
+	if (draw_frame(player, played_keys, coalescer, frame_keys, keyboard, renderer))
 	{
-	  std::cerr << std::strerror(errno) << "\n";
 	  return;
 	}
 
-	const std::chrono::steady_clock::time_point time_now = std::chrono::steady_clock::now();
-	waited_time = time_now - started_time;
-      } while ((is_in_pause) or (waited_time < time_to_wait));
+	// a late frame is not caught up with a burst of frames
+	next_frame = std::max(next_frame + frame_period, now);
+
+	// a short note is not left pressed on screen through a rest or a pause
+	is_frame_pending = coalescer.has_postponed_releases();
+	if (is_frame_pending)
+	{
+	  loop.set_timer(next_frame);
+	}
+      }
+      else
+      {
+	loop.set_timer(next_frame);
+      }
+    }
+
+    loop.wait(events);
+    is_frame_pending = is_frame_pending or events.woken_up;
+
+    for (const auto signum : events.signals)
+    {
+      switch (action_of(signum))
+      {
+	case signal_action::exit:
+	  return;
+
+	case signal_action::pause:
+	  player.pause();
+	  break;
+
+	case signal_action::resume:
+	  player.resume();
+	  break;
+
+	case signal_action::ignore:
+	  break;
+
+#if !defined(__clang__)
+// clang complains that all values are handled in the switch and issue
+// a warning for the default case
+// gcc complains about a missing default
+	default:
+	  __builtin_unreachable();
+#endif
+      }
+    }
+
+    struct tb_event ev;
+    while (events.terminal and (tb_peek_event(&ev, 0) > 0))
+    {
+      switch (ev.type)
+      {
+	case TB_EVENT_KEY:
+	  switch (ev.key)
+	  {
+	    case TB_KEY_CTRL_Q:
+	      return; // ctrl + q means quit
+
+	    case TB_KEY_SPACE:
+	      player.toggle_pause();
+	      break;
+
+	    case TB_KEY_ARROW_LEFT:
+	      player.seek_by(-seek_step);
+	      break;
+
+	    case TB_KEY_ARROW_RIGHT:
+	      player.seek_by(seek_step);
+	      break;
+
+	    case TB_KEY_ARROW_UP:
+	      renderer.set_status("speed: " + std::to_string(player.change_speed(1)) + "%");
+	      break;
+
+	    case TB_KEY_ARROW_DOWN:
+	      renderer.set_status("speed: " + std::to_string(player.change_speed(-1)) + "%");
+	      break;
+
+	    default:
+	      if (ev.ch == 't')
+	      {
+		renderer.set_status(timing.summary());
+	      }
+	      break;
+	  }
+	  break;
+
+	case TB_EVENT_RESIZE:
+	  init_ref_pos(ref_x, ref_y, ev.w, ev.h);
+	  renderer.redraw(keyboard, ref_x, ref_y);
+	  break;
+
+	default:
+	  break;
+      }
     }
   }
 }
 
+struct bench_result bench(song_loader& loader, midi_output& backend, const struct player_options& options)
+{
+  virtual_clock clock (2); // the midi thread, and this one drawing the frames
+  counting_output output (backend);
+  offscreen_screen off_screen (keyboard_width, 40);
+
+  struct keys_color keyboard;
+
+  int ref_x;
+  int ref_y;
+  init_ref_pos(ref_x, ref_y, off_screen);
+
+  keyboard_renderer renderer (off_screen);
+  renderer.redraw(keyboard, ref_x, ref_y);
+
+  key_events_ring played_keys;
+  frame_keys_coalescer coalescer;
+  std::vector<struct key_data> frame_keys;
 
+  playback_timing timing (false);
+
+  const auto wall_start = monotonic_now();
+
+  // the frames are drawn on the virtual clock ticks, whatever was played
+  midi_player player (loader, output, played_keys, timing, clock, [] {});
+  player.start(options.start_at, false);
+
+  // the same frames as the UI would draw, in the virtual time
+  const auto frame_period = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds{ 1 }) / options.fps;
+  const auto start = clock.now();
+  auto next_frame = start;
+
+  // nothing else wakes this thread up but the clock
+  std::mutex unused_mutex;
+  std::condition_variable unused_wake_up;
+  std::unique_lock<std::mutex> lock (unused_mutex);
+
+  for (;;)
+  {
+    clock.wait_until(lock, unused_wake_up, next_frame, [] () { return false; });
+
+    const auto now = clock.now();
+    if (now < next_frame)
+    {
+      continue;
+    }
+
+    if (draw_frame(player, played_keys, coalescer, frame_keys, keyboard, renderer))
+    {
+      break;
+    }
+
+    next_frame = std::max(next_frame + frame_period, now);
+  }
+  clock.leave();
+
+  struct bench_result res;
+  res.wall_time = monotonic_now() - wall_start;
+  res.song_time = clock.now() - start;
+  res.nb_music_events = timing.send_time().count();
+  res.nb_midi_messages = output.nb_messages;
+  res.nb_midi_bytes = output.nb_bytes;
+  res.nb_frames = off_screen.nb_frames;
+  res.nb_cells_drawn = off_screen.nb_cells_changed;
+  return res;
+}
+
+void print_bench_result(const struct bench_result& result, std::ostream& out)
+{
+  const auto wall_seconds = std::chrono::duration<double>(result.wall_time).count();
+  const auto per_second = [wall_seconds] (uint64_t n) {
+    return (wall_seconds > 0.0) ? static_cast<double>(n) / wall_seconds : 0.0;
+  };
+
+  out << std::fixed << std::setprecision(3)
+      << "played " << std::chrono::duration<double>(result.song_time).count() << "s of song in "
+      << wall_seconds << "s\n"
+      << std::setprecision(0)
+      << std::setw(12) << result.nb_music_events << " music events  (" << per_second(result.nb_music_events) << "/s)\n"
+      << std::setw(12) << result.nb_midi_messages << " midi messages (" << per_second(result.nb_midi_messages) << "/s)\n"
+      << std::setw(12) << result.nb_midi_bytes << " midi bytes    (" << per_second(result.nb_midi_bytes) << "/s)\n"
+      << std::setw(12) << result.nb_frames << " frames        (" << per_second(result.nb_frames) << "/s)\n"
+      << std::setw(12) << result.nb_cells_drawn << " cells drawn   (" << per_second(result.nb_cells_drawn) << "/s)\n";
+}
+
+// a key event from the midi input, with the monotonic time it was received
+struct received_key
+{
+    struct key_data key;
+    std::chrono::nanoseconds time;
+
+    received_key()
+      : key ()
+      , time (0)
+    {
+    }
 
+    received_key(const struct key_data& init_key, std::chrono::nanoseconds init_time)
+      : key (init_key)
+      , time (init_time)
+    {
+    }
+};
+
+using received_keys_ring = spsc_ring<struct received_key, 16384>;
+
+// only what can't wait is done on the RtMidi thread: the message is
+// forwarded, and its key event handed over to the UI thread, which draws
+// the keyboard at its own pace.
 struct callback_data_t
 {
-    struct keys_color& keyboard;
-    RtMidiOut& sound_player;
-    int& ref_x;
-    int& ref_y;
+    midi_output& output;
+    received_keys_ring& received_keys;
+    thru_timing& timing;
+    event_loop& loop;
 };
 
 static
-void on_midi_input(double timestamp __attribute__((unused)), std::vector<unsigned char> *message, void* param) {
+void on_midi_input(double timestamp, std::vector<unsigned char> *message, void* param) {
   if (message == nullptr)
   {
     throw std::invalid_argument("Error, invalid input message");
@@ -493,45 +1363,67 @@ void on_midi_input(double timestamp __attribute__((unused)), std::vector<unsigne
 
   auto priv_data = static_cast<struct callback_data_t*>(param);
 
-  std::vector<midi_message> tmp;
-  tmp.push_back(*message);
+  const auto received = monotonic_now();
+  priv_data->output.send(message->data(), message->size(), received);
+  priv_data->timing.record_forward(timestamp, received, monotonic_now());
 
-  play_music(priv_data->sound_player, tmp);
+  // RtMidi gives one message at a time: a key event is three bytes long
+  if (message->size() == 3)
+  {
+    const auto data = midi_message(message->data(), message->size());
+    if (is_key_release_event(data))
+    {
+      priv_data->received_keys.push({ { data[1], key_data::type::released }, received });
+    }
+    else if (is_key_down_event(data))
+    {
+      priv_data->received_keys.push({ { data[1], key_data::type::pressed }, received });
+    }
+  }
 
-  const auto key_events = midi_to_key_events(*message);
-  update_keyboard(priv_data->keyboard, key_events);
-  update_screen(priv_data->keyboard, priv_data->ref_x, priv_data->ref_y);
+  priv_data->loop.wake_up();
 }
 
-void play(unsigned int midi_input_port, unsigned int midi_output_port)
+void play(unsigned int midi_input_port, midi_output& output, const struct player_options& options)
 {
+  // reported once the input is closed, and termbox is shut down
+  thru_timing timing;
+  SCOPE_EXIT_BY_REF(if (options.print_timing) { timing.print_report(std::cout); });
+
   RtMidiIn sound_listener (RtMidi::LINUX_ALSA);
-  init_sound(sound_listener, midi_input_port);
+  init_input(sound_listener, midi_input_port);
   SCOPE_EXIT_BY_REF(sound_listener.closePort());
 
-  RtMidiOut sound_player (RtMidi::LINUX_ALSA);
-  init_sound(sound_player, midi_output_port);
-  SCOPE_EXIT_BY_REF(sound_player.closePort());
 
   init_termbox();
   SCOPE_EXIT(tb_shutdown());
+  termbox_screen terminal;
 
 
   struct keys_color keyboard;
 
   int ref_x;
   int ref_y;
-  init_ref_pos(ref_x, ref_y);
-  update_screen(keyboard, ref_x, ref_y);
+  init_ref_pos(ref_x, ref_y, terminal);
+
+  keyboard_renderer renderer (terminal);
+  renderer.redraw(keyboard, ref_x, ref_y);
 
+  received_keys_ring received_keys;
+  key_events_ring played_keys; // only used by this thread, to go through the coalescer
+  frame_keys_coalescer coalescer;
+  std::vector<struct key_data> frame_keys;
+  std::vector<std::chrono::nanoseconds> pressed_times; // when the keys pressed in the frame were received
 
-  struct callback_data_t callback_data =  { .keyboard = keyboard,
-					    .sound_player = sound_player,
-					    .ref_x = ref_x,
-					    .ref_y = ref_y };
+  event_loop loop;
+  struct callback_data_t callback_data =  { .output = output,
+					    .received_keys = received_keys,
+					    .timing = timing,
+					    .loop = loop };
 
 
   sound_listener.setCallback(on_midi_input, &callback_data);
+  SCOPE_EXIT_BY_REF(sound_listener.cancelCallback());
 
   // This mode is playing from a midi keyboard as input, not a midi
   // file.  In this mode there is no play/pause. It wouldn't make
@@ -539,33 +1431,105 @@ void play(unsigned int midi_input_port, unsigned int midi_output_port)
   // requiring to shutdown the program, and will happily ignore any
   // SIGINT/SIGCONT it might receive.
 
+  // the keys played are shown at most options.fps times per second
+  const auto frame_period = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds{ 1 }) / options.fps;
+  auto next_frame = monotonic_now();
+  bool is_frame_pending = true;
+
+  // the latency is shown once a second, when it changed
+  constexpr const std::chrono::seconds status_period { 1 };
+  auto next_status = next_frame;
+  uint64_t nb_shown_messages = 0;
+
+  struct loop_events events;
   for (;;)
   {
-    if (exit_required)
+    if (is_frame_pending)
     {
-      return;
-    }
+      const auto now = monotonic_now();
+      if (now >= next_frame)
+      {
+	struct received_key received;
+	while (received_keys.pop(received))
+	{
+	  played_keys.push(received.key);
+	  if (received.key.ev_type == key_data::type::pressed)
+	  {
+	    pressed_times.push_back(received.time);
+	  }
+	}
 
-    struct tb_event ev;
+	coalescer.next_frame(played_keys, frame_keys);
+	if (not frame_keys.empty())
+	{
+	  update_keyboard(keyboard, frame_keys);
+	  renderer.update(keyboard);
+	}
 
-    // use peek_event with a _small_ timeout instead of waiting forever
-    // as we may need to quit if we got a signal requesting so.
-    const auto ret_val = tb_peek_event(&ev, 100 /* timeout in ms */);
+	// the coalescer never postpones a key press: they are all on screen
+	const auto shown = monotonic_now();
+	for (const auto time : pressed_times)
+	{
+	  timing.record_display(time, shown);
+	}
+	pressed_times.clear();
 
-    switch (ret_val)
-    {
-      case TB_EVENT_RESIZE:
-	init_ref_pos(ref_x, ref_y, ev.w, ev.h);
-	update_screen(keyboard, ref_x, ref_y);
-	break;
-      case TB_EVENT_KEY:
-	if (ev.key == TB_KEY_CTRL_Q)
+	if ((now >= next_status) and (timing.nb_forwarded() != nb_shown_messages))
 	{
-	  return; // ctrl + q means quit
+	  nb_shown_messages = timing.nb_forwarded();
+	  renderer.set_status(timing.summary());
+	  next_status = now + status_period;
 	}
-	break;
-      default:
-	break;
+	// a late frame is not caught up with a burst of frames
+	next_frame = std::max(next_frame + frame_period, now);
+
+	// a short note is not left pressed on screen until the next input
+	is_frame_pending = coalescer.has_postponed_releases();
+	if (is_frame_pending)
+	{
+	  loop.set_timer(next_frame);
+	}
+	// a status not shown yet is shown once due, even if nothing is played
+	else if (timing.nb_forwarded() != nb_shown_messages)
+	{
+	  loop.set_timer(std::max(next_status, next_frame));
+	}
+      }
+      else
+      {
+	loop.set_timer(next_frame);
+      }
+    }
+
+    loop.wait(events);
+    is_frame_pending = is_frame_pending or events.woken_up or events.timer;
+
+    for (const auto signum : events.signals)
+    {
+      if (action_of(signum) == signal_action::exit)
+      {
+	return;
+      }
+    }
+
+    struct tb_event ev;
+    while (events.terminal and (tb_peek_event(&ev, 0) > 0))
+    {
+      switch (ev.type)
+      {
+	case TB_EVENT_RESIZE:
+	  init_ref_pos(ref_x, ref_y, ev.w, ev.h);
+	  renderer.redraw(keyboard, ref_x, ref_y);
+	  break;
+	case TB_EVENT_KEY:
+	  if (ev.key == TB_KEY_CTRL_Q)
+	  {
+	    return; // ctrl + q means quit
+	  }
+	  break;
+	default:
+	  break;
+      }
     }
   }
 }
@@ -1,12 +1,68 @@
 #ifndef MUSIC_PLAYER_HH_
 #define MUSIC_PLAYER_HH_
 
+#include <chrono>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
 #include "utils.hh"
+#include "song_loader.hh"
+#include "midi_output.hh"
+
+struct player_options
+{
+    bool realtime; // give the midi output thread a real-time priority, and lock the memory
+    unsigned int fps; // maximum number of frames drawn per second, must not be 0
+    std::chrono::nanoseconds start_at; // song time to start playing from
+    bool print_timing; // print how late the music events were played, at exit
+    std::string timing_csv; // file to write the timing of every music event to, if not empty
+
+    player_options()
+      : realtime (false)
+      , fps (60)
+      , start_at (0)
+      , print_timing (false)
+      , timing_csv ()
+    {
+    }
+};
+
+// plays the song while it is being loaded
+void play(song_loader& loader, midi_output& output, const struct player_options& options);
+
+// what went through the player when replaying a song as fast as possible
+struct bench_result
+{
+    std::chrono::nanoseconds wall_time;
+    std::chrono::nanoseconds song_time; // how much of the song was played
+    uint64_t nb_music_events;
+    uint64_t nb_midi_messages;
+    uint64_t nb_midi_bytes;
+    uint64_t nb_frames;
+    uint64_t nb_cells_drawn;
+
+    bench_result()
+      : wall_time (0)
+      , song_time (0)
+      , nb_music_events (0)
+      , nb_midi_messages (0)
+      , nb_midi_bytes (0)
+      , nb_frames (0)
+      , nb_cells_drawn (0)
+    {
+    }
+};
 
+// plays the song through the same scheduling, drawing and output code as
+// play(), but on a virtual clock jumping from one deadline to the next, to
+// the given midi output (the messages are counted on the way), and drawing
+// off-screen. Needs neither a sequencer nor a terminal with the null output.
+struct bench_result bench(song_loader& loader, midi_output& output, const struct player_options& options);
 
-void play(const std::vector<struct music_event>& music, unsigned int midi_output_port);
+void print_bench_result(const struct bench_result& result, std::ostream& out);
 
 // listen to a midi input, plays it to output
-void play(unsigned int midi_input_port, unsigned int midi_output_port);
+void play(unsigned int midi_input_port, midi_output& output, const struct player_options& options);
 
 #endif /* MUSIC_PLAYER_HH_ */
@@ -0,0 +1,72 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <system_error>
+
+#include "parallel.hh"
+
+void parallel_for(std::size_t nb_tasks,
+		  const std::function<void(std::size_t)>& task,
+		  unsigned int max_threads)
+{
+  if (max_threads == 0)
+  {
+    // hardware_concurrency is allowed to return 0 when it doesn't know.
+    max_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  const auto nb_threads = static_cast<std::size_t>(std::min<std::size_t>(max_threads, nb_tasks));
+
+  std::atomic<std::size_t> next_task { 0 };
+  std::mutex error_mutex;
+  std::exception_ptr first_error;
+  auto first_error_task = nb_tasks;
+
+  const auto worker = [&] () {
+    for (auto i = next_task++; i < nb_tasks; i = next_task++)
+    {
+      try
+      {
+	task(i);
+      }
+      catch (...)
+      {
+	std::lock_guard<std::mutex> lock (error_mutex);
+	if (i < first_error_task)
+	{
+	  first_error_task = i;
+	  first_error = std::current_exception();
+	}
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  try
+  {
+    for (auto i = decltype(nb_threads){1}; i < nb_threads; ++i)
+    {
+      threads.emplace_back(worker);
+    }
+  }
+  catch (std::system_error&)
+  {
+    // out of threads: the ones already started (and the calling thread) will
+    // process the remaining tasks.
+  }
+
+  worker(); // the calling thread works too
+
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+
+  if (first_error)
+  {
+    std::rethrow_exception(first_error);
+  }
+}
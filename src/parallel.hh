@@ -0,0 +1,18 @@
+#ifndef PARALLEL_HH_
+#define PARALLEL_HH_
+
+#include <cstddef> // for std::size_t
+#include <functional>
+
+// runs task(0) ... task(nb_tasks - 1) on up to max_threads threads, the
+// calling thread included (0 means one thread per core). Tasks are handed out
+// one at a time to whichever thread is free, so a few long tasks don't keep
+// the other threads idle.
+//
+// If some tasks throw, the other tasks still run, and the exception of the
+// lowest task index is rethrown once every thread is done.
+void parallel_for(std::size_t nb_tasks,
+		  const std::function<void(std::size_t)>& task,
+		  unsigned int max_threads = 0);
+
+#endif /* PARALLEL_HH_ */
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <time.h> // for clock_gettime and clock_nanosleep
+
+#include "playback_clock.hh"
+
+playback_clock::~playback_clock()
+{
+}
+
+std::chrono::nanoseconds monotonic_now()
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    throw std::runtime_error(std::string{"Error while reading the monotonic clock: "} + std::strerror(errno));
+  }
+
+  return std::chrono::seconds{ now.tv_sec } + std::chrono::nanoseconds{ now.tv_nsec };
+}
+
+// sleeps until the given CLOCK_MONOTONIC time. The handled signals are
+// blocked in every thread (see block_handled_signals): they don't interrupt
+// it.
+static void sleep_until(std::chrono::nanoseconds deadline)
+{
+  struct timespec wake_up;
+
+  using timespec_seconds = std::chrono::duration<decltype(wake_up.tv_sec)>;
+  using timespec_nanoseconds = std::chrono::duration<decltype(wake_up.tv_nsec), std::nano>;
+
+  const auto secs = std::chrono::duration_cast<timespec_seconds>(deadline);
+  wake_up.tv_sec = secs.count();
+  wake_up.tv_nsec = std::chrono::duration_cast<timespec_nanoseconds>(deadline - secs).count();
+
+  // an EINTR from another signal only ends the sleep early, the caller
+  // sleeps again.
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_up, nullptr);
+}
+
+std::chrono::nanoseconds monotonic_clock::now()
+{
+  return monotonic_now();
+}
+
+void monotonic_clock::wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& wake_up,
+				 std::chrono::nanoseconds deadline, const std::function<bool()>& is_woken_up)
+{
+  // a condition variable is used to be woken up on pause/resume/stop,
+  // but its timeouts are not that precise on every system: the last two
+  // milliseconds before the deadline are left to clock_nanosleep. Nothing
+  // can wake that one up, so it sleeps in short slices, checking
+  // is_woken_up in between.
+  constexpr const std::chrono::milliseconds precise_sleep_time { 2 };
+  constexpr const std::chrono::microseconds precise_sleep_slice { 200 };
+
+  const auto remaining = deadline - monotonic_now();
+  if ((remaining > precise_sleep_time) and
+      wake_up.wait_for(lock, remaining - precise_sleep_time, is_woken_up))
+  {
+    return;
+  }
+
+  while (not is_woken_up())
+  {
+    const auto now = monotonic_now();
+    if (now >= deadline)
+    {
+      return;
+    }
+
+    lock.unlock();
+    sleep_until(std::min(deadline, now + std::chrono::nanoseconds{ precise_sleep_slice }));
+    lock.lock();
+  }
+}
+
+virtual_clock::virtual_clock(unsigned int nb_threads)
+  : mutex ()
+  , time_changed ()
+  , current_time (0)
+  , nb_running (nb_threads)
+  , deadlines ()
+{
+}
+
+std::chrono::nanoseconds virtual_clock::now()
+{
+  std::lock_guard<std::mutex> guard (mutex);
+  return current_time;
+}
+
+void virtual_clock::advance_if_all_waiting()
+{
+  if ((nb_running == 0) and (not deadlines.empty()))
+  {
+    current_time = std::max(current_time, *deadlines.begin());
+    time_changed.notify_all();
+  }
+}
+
+void virtual_clock::wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& /* wake_up */,
+			       std::chrono::nanoseconds deadline, const std::function<bool()>& /* is_woken_up */)
+{
+  // the other threads only wake this one up by moving the time, so there is
+  // no need to listen to wake_up.
+  lock.unlock();
+
+  {
+    std::unique_lock<std::mutex> clock_lock (mutex);
+    if (deadline > current_time)
+    {
+      const auto pos = deadlines.insert(deadline);
+      --nb_running;
+      advance_if_all_waiting();
+
+      time_changed.wait(clock_lock, [&] { return current_time >= deadline; });
+
+      deadlines.erase(pos);
+      ++nb_running;
+    }
+  }
+
+  lock.lock();
+}
+
+void virtual_clock::leave()
+{
+  std::lock_guard<std::mutex> guard (mutex);
+  --nb_running;
+  advance_if_all_waiting();
+}
@@ -0,0 +1,69 @@
+#ifndef PLAYBACK_CLOCK_HH_
+#define PLAYBACK_CLOCK_HH_
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <set>
+
+// the time the player schedules the music events on
+class playback_clock
+{
+  public:
+    virtual ~playback_clock();
+
+    virtual std::chrono::nanoseconds now() = 0;
+
+    // waits until the clock reaches the deadline, or until is_woken_up
+    // returns true. The lock is released meanwhile, and is_woken_up is
+    // called with the lock held, at least each time wake_up is notified.
+    // The caller is expected to check what it is waiting for, and wait
+    // again.
+    virtual void wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& wake_up,
+			    std::chrono::nanoseconds deadline, const std::function<bool()>& is_woken_up) = 0;
+
+    // tells that the calling thread won't wait on the clock anymore
+    virtual void leave()
+    {
+    }
+};
+
+// the CLOCK_MONOTONIC time
+class monotonic_clock final : public playback_clock
+{
+  public:
+    std::chrono::nanoseconds now() override;
+    void wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& wake_up,
+		    std::chrono::nanoseconds deadline, const std::function<bool()>& is_woken_up) override;
+};
+
+// a clock which never lets time pass for nothing: once every thread using
+// it is waiting, it jumps straight to the earliest deadline. Threads only
+// wake each other up through the clock, so a song is played as fast as the
+// code allows, always in the same way.
+class virtual_clock final : public playback_clock
+{
+  public:
+    explicit virtual_clock(unsigned int nb_threads);
+
+    std::chrono::nanoseconds now() override;
+    void wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& wake_up,
+		    std::chrono::nanoseconds deadline, const std::function<bool()>& is_woken_up) override;
+    void leave() override;
+
+  private:
+    // must be called with the mutex held
+    void advance_if_all_waiting();
+
+    std::mutex mutex;
+    std::condition_variable time_changed;
+    std::chrono::nanoseconds current_time;
+    unsigned int nb_running; // threads not waiting on the clock
+    std::multiset<std::chrono::nanoseconds> deadlines; // of the waiting threads
+};
+
+// reads CLOCK_MONOTONIC
+std::chrono::nanoseconds monotonic_now();
+
+#endif /* PLAYBACK_CLOCK_HH_ */
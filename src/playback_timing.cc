@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <limits>
+
+#include "playback_timing.hh"
+
+constexpr const unsigned int duration_histogram::nb_sub_buckets;
+constexpr const std::size_t duration_histogram::nb_buckets;
+
+static unsigned int most_significant_bit(uint64_t value)
+{
+  return 63 - static_cast<unsigned int>(__builtin_clzll(value));
+}
+
+// values below 16 have a bucket each. Above, the 4 bits after the most
+// significant one give the bucket among the 16 of that power of two.
+static unsigned int bucket_of(uint64_t value)
+{
+  if (value < duration_histogram::nb_sub_buckets)
+  {
+    return static_cast<unsigned int>(value);
+  }
+
+  const auto msb = most_significant_bit(value);
+  return (msb - 3) * duration_histogram::nb_sub_buckets + static_cast<unsigned int>((value >> (msb - 4)) & 0xF);
+}
+
+static uint64_t lower_bound_of(std::size_t bucket)
+{
+  if (bucket < duration_histogram::nb_sub_buckets)
+  {
+    return bucket;
+  }
+
+  const auto msb = bucket / duration_histogram::nb_sub_buckets + 3;
+  return (duration_histogram::nb_sub_buckets + bucket % duration_histogram::nb_sub_buckets) << (msb - 4);
+}
+
+static uint64_t upper_bound_of(std::size_t bucket)
+{
+  return (bucket + 1 < duration_histogram::nb_buckets) ? lower_bound_of(bucket + 1) : std::numeric_limits<uint64_t>::max();
+}
+
+static std::string format_duration(std::chrono::nanoseconds duration)
+{
+  const auto ns = static_cast<double>(duration.count());
+
+  std::ostringstream res;
+  res << std::fixed << std::setprecision(1);
+  if (std::abs(ns) < 1e3)
+  {
+    res << std::setprecision(0) << ns << "ns";
+  }
+  else if (std::abs(ns) < 1e6)
+  {
+    res << ns / 1e3 << "us";
+  }
+  else if (std::abs(ns) < 1e9)
+  {
+    res << ns / 1e6 << "ms";
+  }
+  else
+  {
+    res << ns / 1e9 << "s";
+  }
+  return res.str();
+}
+
+duration_histogram::duration_histogram()
+  : buckets ()
+  , nb_values (0)
+  , max_value (0)
+{
+  for (auto& bucket : buckets)
+  {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+void duration_histogram::add(std::chrono::nanoseconds duration)
+{
+  const auto value = std::max(duration.count(), std::chrono::nanoseconds::rep{ 0 });
+
+  // there is only one writer: no need for an atomic read-modify-write
+  auto& bucket = buckets[bucket_of(static_cast<uint64_t>(value))];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  nb_values.store(nb_values.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+  if (value > max_value.load(std::memory_order_relaxed))
+  {
+    max_value.store(value, std::memory_order_relaxed);
+  }
+}
+
+uint64_t duration_histogram::count() const
+{
+  return nb_values.load(std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds duration_histogram::max() const
+{
+  return std::chrono::nanoseconds{ max_value.load(std::memory_order_relaxed) };
+}
+
+std::chrono::nanoseconds duration_histogram::percentile(double fraction) const
+{
+  const auto total = count();
+  if (total == 0)
+  {
+    return std::chrono::nanoseconds{ 0 };
+  }
+
+  const auto rank = std::max(static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(total))), uint64_t{ 1 });
+
+  uint64_t nb_seen = 0;
+  for (std::size_t i = 0; i < buckets.size(); ++i)
+  {
+    nb_seen += buckets[i].load(std::memory_order_relaxed);
+    if (nb_seen >= rank)
+    {
+      // the upper bound of the bucket, never above the largest value
+      const auto value = std::min(upper_bound_of(i) - 1, static_cast<uint64_t>(max().count()));
+      return std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(value) };
+    }
+  }
+
+  return max();
+}
+
+void duration_histogram::print(std::ostream& out) const
+{
+  out << "  p50 " << format_duration(percentile(0.5))
+      << ", p99 " << format_duration(percentile(0.99))
+      << ", p99.9 " << format_duration(percentile(0.999))
+      << ", max " << format_duration(max())
+      << " (" << count() << " values)\n";
+
+  // bin 0 holds the zeros, bin n > 0 the values in [2^(n-1), 2^n)
+  std::array<uint64_t, 65> bins {};
+  for (std::size_t i = 0; i < buckets.size(); ++i)
+  {
+    const auto lower_bound = lower_bound_of(i);
+    const auto bin = (lower_bound == 0) ? 0 : most_significant_bit(lower_bound) + 1;
+    bins[bin] += buckets[i].load(std::memory_order_relaxed);
+  }
+
+  const auto first = std::find_if(bins.begin(), bins.end(), [] (uint64_t n) { return n != 0; });
+  if (first == bins.end())
+  {
+    return;
+  }
+  const auto last = std::find_if(bins.rbegin(), bins.rend(), [] (uint64_t n) { return n != 0; }).base();
+  const auto biggest = *std::max_element(first, last);
+
+  constexpr const uint64_t bar_width = 40;
+  for (auto bin = first; bin != last; ++bin)
+  {
+    const auto n = static_cast<unsigned int>(bin - bins.begin());
+    const auto from = (n == 0) ? 0 : int64_t{ 1 } << (n - 1);
+    const auto to = (n == 0) ? 1 : int64_t{ 1 } << n;
+
+    out << "  [" << std::setw(8) << format_duration(std::chrono::nanoseconds{ from })
+	<< ", " << std::setw(8) << format_duration(std::chrono::nanoseconds{ to }) << ") "
+	<< std::setw(10) << *bin << " "
+	<< std::string(static_cast<unsigned int>((*bin * bar_width + biggest - 1) / biggest), '#') << "\n";
+  }
+}
+
+playback_timing::playback_timing(bool init_keep_events)
+  : lateness_histogram ()
+  , send_time_histogram ()
+  , keep_events (init_keep_events)
+  , events ()
+{
+}
+
+void playback_timing::record(const struct event_timing& timing)
+{
+  lateness_histogram.add(timing.send_start - timing.deadline);
+  send_time_histogram.add(timing.send_end - timing.send_start);
+
+  if (keep_events)
+  {
+    events.push_back(timing);
+  }
+}
+
+std::string playback_timing::summary() const
+{
+  return "late by p50 " + format_duration(lateness_histogram.percentile(0.5)) +
+    ", p99 " + format_duration(lateness_histogram.percentile(0.99)) +
+    ", p99.9 " + format_duration(lateness_histogram.percentile(0.999)) +
+    ", max " + format_duration(lateness_histogram.max());
+}
+
+void playback_timing::print_report(std::ostream& out) const
+{
+  out << "Lateness of the music events (sending started after the deadline):\n";
+  lateness_histogram.print(out);
+  out << "Time spent sending the midi messages of a music event:\n";
+  send_time_histogram.print(out);
+}
+
+void playback_timing::write_csv(std::ostream& out) const
+{
+  out << "event,song_time_ns,deadline_ns,send_start_ns,send_end_ns,lateness_ns,send_time_ns,messages\n";
+
+  std::size_t i = 0;
+  for (const auto& timing : events)
+  {
+    out << i << ','
+	<< timing.song_time.count() << ','
+	<< timing.deadline.count() << ','
+	<< timing.send_start.count() << ','
+	<< timing.send_end.count() << ','
+	<< (timing.send_start - timing.deadline).count() << ','
+	<< (timing.send_end - timing.send_start).count() << ','
+	<< timing.nb_messages << '\n';
+    ++i;
+  }
+}
+
+thru_timing::thru_timing()
+  : delivery_histogram ()
+  , forward_histogram ()
+  , display_histogram ()
+  , input_time (0.0)
+  , has_input (false)
+  , min_delivery_offset (0)
+{
+}
+
+void thru_timing::record_forward(double rtmidi_delta, std::chrono::nanoseconds received, std::chrono::nanoseconds sent)
+{
+  // the sequencer clock and the monotonic one have different origins: the
+  // delivery delay is measured from the message delivered the fastest.
+  input_time = has_input ? input_time + rtmidi_delta : 0.0;
+  const auto offset = received - std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(input_time));
+  if ((not has_input) or (offset < min_delivery_offset))
+  {
+    min_delivery_offset = offset;
+    has_input = true;
+  }
+
+  delivery_histogram.add(offset - min_delivery_offset);
+  forward_histogram.add(sent - received);
+}
+
+void thru_timing::record_display(std::chrono::nanoseconds received, std::chrono::nanoseconds shown)
+{
+  display_histogram.add(shown - received);
+}
+
+std::string thru_timing::summary() const
+{
+  return "thru p50 " + format_duration(forward_histogram.percentile(0.5)) +
+    " p99 " + format_duration(forward_histogram.percentile(0.99)) +
+    ", on screen p50 " + format_duration(display_histogram.percentile(0.5)) +
+    " p99 " + format_duration(display_histogram.percentile(0.99));
+}
+
+void thru_timing::print_report(std::ostream& out) const
+{
+  out << "Delivery of the midi input, later than the fastest one:\n";
+  delivery_histogram.print(out);
+  out << "From receiving a message to having forwarded it:\n";
+  forward_histogram.print(out);
+  out << "From receiving a key event to having shown it:\n";
+  display_histogram.print(out);
+}
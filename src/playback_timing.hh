@@ -0,0 +1,142 @@
+#ifndef PLAYBACK_TIMING_HH_
+#define PLAYBACK_TIMING_HH_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+// distribution of durations. The buckets are spaced log-linearly: 16 per
+// power of two, so any value is known within 1/16th (6.25%) of it, from
+// nanoseconds up to centuries, in a fixed amount of memory.
+//
+// Adding a value is a handful of instructions, without locks nor
+// allocations. Only one thread may add values, but any thread can read the
+// distribution meanwhile: it then sees the values added up to some point.
+class duration_histogram
+{
+  public:
+    static constexpr const unsigned int nb_sub_buckets = 16;
+    static constexpr const std::size_t nb_buckets = (63 - 3) * nb_sub_buckets;
+
+    duration_histogram();
+
+    duration_histogram(const duration_histogram&) = delete;
+    duration_histogram& operator=(const duration_histogram&) = delete;
+
+    // negative durations are counted as 0
+    void add(std::chrono::nanoseconds duration);
+
+    uint64_t count() const;
+    std::chrono::nanoseconds max() const;
+
+    // the smallest duration above the given fraction of the values (0.5 for
+    // the median), up to the precision of the buckets.
+    std::chrono::nanoseconds percentile(double fraction) const;
+
+    // writes the percentiles, then the number of values per power of two
+    void print(std::ostream& out) const;
+
+  private:
+    std::array<std::atomic<uint64_t>, nb_buckets> buckets;
+    std::atomic<uint64_t> nb_values;
+    std::atomic<std::chrono::nanoseconds::rep> max_value;
+};
+
+// when a music event was due, and when it actually went out
+struct event_timing
+{
+    std::chrono::nanoseconds song_time;
+    std::chrono::nanoseconds deadline; // CLOCK_MONOTONIC time
+    std::chrono::nanoseconds send_start; // CLOCK_MONOTONIC time, just before the first message is sent
+    std::chrono::nanoseconds send_end; // CLOCK_MONOTONIC time, just after the last message is sent
+    uint32_t nb_messages;
+};
+
+// records the timing of every music event played. It is cheap enough to be
+// always on: only the histograms are filled, unless every event has to be
+// kept to be written as CSV later.
+class playback_timing
+{
+  public:
+    explicit playback_timing(bool keep_events);
+
+    playback_timing(const playback_timing&) = delete;
+    playback_timing& operator=(const playback_timing&) = delete;
+
+    // called by the thread sending the midi messages only
+    void record(const struct event_timing& timing);
+
+    // how late the music events started to be sent
+    const duration_histogram& lateness() const
+    {
+      return lateness_histogram;
+    }
+
+    // how long sending the messages of a music event took
+    const duration_histogram& send_time() const
+    {
+      return send_time_histogram;
+    }
+
+    // a one line summary, fit for a status line
+    std::string summary() const;
+
+    void print_report(std::ostream& out) const;
+
+    // writes one line per music event. Only to be called once the events
+    // are no longer recorded, and if they were kept.
+    void write_csv(std::ostream& out) const;
+
+  private:
+    duration_histogram lateness_histogram;
+    duration_histogram send_time_histogram;
+
+    bool keep_events;
+    std::deque<struct event_timing> events; // a deque grows without moving what is already recorded
+};
+
+// the latency added by pianoterm when it forwards a midi input to a midi
+// output, and shows the keys played.
+class thru_timing
+{
+  public:
+    thru_timing();
+
+    thru_timing(const thru_timing&) = delete;
+    thru_timing& operator=(const thru_timing&) = delete;
+
+    // called by the thread receiving the midi input only. rtmidi_delta is
+    // the timestamp RtMidi gives: the seconds since the previous message.
+    void record_forward(double rtmidi_delta, std::chrono::nanoseconds received, std::chrono::nanoseconds sent);
+
+    // called by the thread drawing the keys only
+    void record_display(std::chrono::nanoseconds received, std::chrono::nanoseconds shown);
+
+    uint64_t nb_forwarded() const
+    {
+      return forward_histogram.count();
+    }
+
+    // a one line summary, fit for a status line
+    std::string summary() const;
+
+    void print_report(std::ostream& out) const;
+
+  private:
+    duration_histogram delivery_histogram;
+    duration_histogram forward_histogram;
+    duration_histogram display_histogram;
+
+    // the times the sequencer gave to the messages, summed from the deltas
+    // RtMidi gives, in seconds since the first message.
+    double input_time;
+    bool has_input;
+    std::chrono::nanoseconds min_delivery_offset; // of the message delivered the fastest
+};
+
+#endif /* PLAYBACK_TIMING_HH_ */
@@ -0,0 +1,75 @@
+#include <termbox.h>
+
+#include "screen.hh"
+
+screen::~screen()
+{
+}
+
+int termbox_screen::width()
+{
+  return tb_width();
+}
+
+int termbox_screen::height()
+{
+  return tb_height();
+}
+
+void termbox_screen::clear()
+{
+  tb_clear();
+}
+
+void termbox_screen::change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg)
+{
+  tb_change_cell(x, y, ch, fg, bg);
+}
+
+void termbox_screen::present()
+{
+  tb_present();
+}
+
+offscreen_screen::offscreen_screen(int init_width, int init_height)
+  : nb_cells_changed (0)
+  , nb_frames (0)
+  , screen_width (init_width)
+  , screen_height (init_height)
+  , cells (static_cast<std::size_t>(init_width * init_height))
+{
+}
+
+int offscreen_screen::width()
+{
+  return screen_width;
+}
+
+int offscreen_screen::height()
+{
+  return screen_height;
+}
+
+void offscreen_screen::clear()
+{
+  for (auto& c : cells)
+  {
+    c = { ' ', TB_DEFAULT, TB_DEFAULT };
+  }
+}
+
+void offscreen_screen::change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg)
+{
+  ++nb_cells_changed;
+
+  // like termbox, cells out of the screen are ignored
+  if ((x >= 0) and (x < screen_width) and (y >= 0) and (y < screen_height))
+  {
+    cells[static_cast<std::size_t>(y * screen_width + x)] = { ch, fg, bg };
+  }
+}
+
+void offscreen_screen::present()
+{
+  ++nb_frames;
+}
@@ -0,0 +1,60 @@
+#ifndef SCREEN_HH_
+#define SCREEN_HH_
+
+#include <vector>
+#include <cstdint>
+
+// what the keyboard is drawn on: a grid of cells, shown all at once by
+// present().
+class screen
+{
+  public:
+    virtual ~screen();
+
+    virtual int width() = 0;
+    virtual int height() = 0;
+    virtual void clear() = 0;
+    virtual void change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg) = 0;
+    virtual void present() = 0;
+};
+
+// the terminal, through termbox. termbox must be initialised.
+class termbox_screen final : public screen
+{
+  public:
+    int width() override;
+    int height() override;
+    void clear() override;
+    void change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg) override;
+    void present() override;
+};
+
+// cells kept in memory, never shown. It counts what is drawn on it.
+class offscreen_screen final : public screen
+{
+  public:
+    offscreen_screen(int init_width, int init_height);
+
+    int width() override __attribute__((pure));
+    int height() override __attribute__((pure));
+    void clear() override;
+    void change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg) override;
+    void present() override;
+
+    uint64_t nb_cells_changed;
+    uint64_t nb_frames;
+
+  private:
+    struct cell
+    {
+	uint32_t ch;
+	uint16_t fg;
+	uint16_t bg;
+    };
+
+    int screen_width;
+    int screen_height;
+    std::vector<struct cell> cells;
+};
+
+#endif /* SCREEN_HH_ */
@@ -1,107 +1,39 @@
 #include <signal.h>
-#include <cstring> // for memset
+#include <cstring> // for strerror
 #include <cerrno>
 #include <stdexcept>
 #include <string>
 
-#include "signals_handler.hh"
-
-extern volatile sig_atomic_t pause_required;
-extern volatile sig_atomic_t continue_required;
-extern volatile sig_atomic_t exit_required;
-
-volatile sig_atomic_t pause_required = 0;
-volatile sig_atomic_t continue_required = 0;
-volatile sig_atomic_t exit_required = 0;
-
-static
-const char* signum_to_str(int signum)
-{
-  switch (signum)
-  {
-    case  SIGHUP:     return  "SIGHUP";
-    case  SIGINT:     return  "SIGINT";
-    case  SIGQUIT:    return  "SIGQUIT";
-    case  SIGILL:     return  "SIGILL";
-    case  SIGABRT:    return  "SIGABRT";
-    case  SIGFPE:     return  "SIGFPE";
-    case  SIGKILL:    return  "SIGKILL";
-    case  SIGSEGV:    return  "SIGSEGV";
-    case  SIGPIPE:    return  "SIGPIPE";
-    case  SIGALRM:    return  "SIGALRM";
-    case  SIGTERM:    return  "SIGTERM";
-    case  SIGUSR1:    return  "SIGUSR1";
-    case  SIGUSR2:    return  "SIGUSR2";
-    case  SIGCHLD:    return  "SIGCHLD";
-    case  SIGCONT:    return  "SIGCONT";
-    case  SIGSTOP:    return  "SIGSTOP";
-    case  SIGTSTP:    return  "SIGTSTP";
-    case  SIGTTIN:    return  "SIGTTIN";
-    case  SIGTTOU:    return  "SIGTTOU";
-    case  SIGBUS:     return  "SIGBUS";
-    case  SIGPOLL:    return  "SIGPOLL";
-    case  SIGPROF:    return  "SIGPROF";
-    case  SIGSYS:     return  "SIGSYS";
-    case  SIGTRAP:    return  "SIGTRAP";
-    case  SIGURG:     return  "SIGURG";
-    case  SIGVTALRM:  return  "SIGVTALRM";
-    case  SIGXCPU:    return  "SIGXCPU";
-    case  SIGXFSZ:    return  "SIGXFSZ";
-    case  SIGSTKFLT:  return  "SIGSTKFLT";
-    case  SIGPWR:     return  "SIGPWR";
-    case  SIGWINCH:   return  "SIGWINCH";
+#include <pthread.h> // for pthread_sigmask
 
-    default:
-      return "unknown signal";
-  }
-}
+#include "signals_handler.hh"
 
-static void signal_handler(int signum)
+enum signal_action action_of(int signum)
 {
   switch (signum)
   {
     case SIGINT:  // Interrupt from keyboard
-      pause_required = 1;
-      break;
+      return signal_action::pause;
 
     case SIGCONT: // Continue if stopped
-      continue_required = 1;
-      break;
+      return signal_action::resume;
 
     case SIGQUIT: // stop program
     case SIGTERM:
     case SIGTSTP:
-      exit_required = 1;
-      break;
+      return signal_action::exit;
 
     case SIGUSR1: // User-defined signal 1
     case SIGUSR2: // User-defined signal 2
     default:
-      break; // ignore these errors, but don't let the program stop for these.
+      return signal_action::ignore; // ignore these errors, but don't let the program stop for these.
   }
 }
 
-
-#if defined(__clang__)
-  // clang will complain that sa_handler is a recursive macro.
-  // It issue this warning even when explictly disabling warnings from system headers
-  // using -Wno-system-headers Below is the error it produces.
-  //
-  // signals_handler.cc:102:6: error: disabled expansion of recursive macro
-  //       [-Werror,-Wdisabled-macro-expansion]
-  //   sa.sa_handler = &signal_handler;
-  //      ^
-  // /usr/include/i386-linux-gnu/bits/sigaction.h:36:41: note: expanded from macro 'sa_handler'
-  // # define sa_handler     __sigaction_handler.sa_handler
-  #pragma clang diagnostic push
-  #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
-#endif
-
-void set_signal_handler()
+sigset_t handled_signals()
 {
-  struct sigaction sa;
-  std::memset(&sa, 0, sizeof(struct sigaction));
-  sa.sa_handler = &signal_handler;
+  sigset_t res;
+  sigemptyset(&res);
 
   for (const auto signum : { SIGINT, // Interrupt from keyboard
 			     SIGCONT, // Continue if stopped
@@ -112,15 +44,18 @@ void set_signal_handler()
 			     SIGUSR2 // User-defined signal 2
 			   })
   {
-    if (sigaction(signum, &sa, nullptr) == -1)
-    {
-
-      throw std::runtime_error(std::string{"Error while setting the interrupt hangler for signal "} + signum_to_str(signum) +
-			       " (" + std::strerror(errno) + ")");
-    }
+    sigaddset(&res, signum);
   }
 
+  return res;
+}
+
+void block_handled_signals()
+{
+  const auto signals = handled_signals();
+  const auto error = pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  if (error != 0)
+  {
+    throw std::runtime_error(std::string{"Error while blocking the signals: "} + std::strerror(error));
+  }
 }
-#if defined(__clang__)
-  #pragma clang diagnostic pop
-#endif
@@ -1,6 +1,27 @@
 #ifndef SIGNALS_HANDLER_HH_
 #define SIGNALS_HANDLER_HH_
 
-void set_signal_handler();
+#include <signal.h>
+
+// what the player does when it receives a signal
+enum class signal_action
+{
+  pause,
+  resume,
+  exit,
+  ignore,
+};
+
+enum signal_action action_of(int signum) __attribute__((const));
+
+// the signals the player reacts to
+sigset_t handled_signals();
+
+// blocks the handled signals in the calling thread, and in the threads it
+// creates afterwards, so that they are only received through a signalfd
+// (see event_loop), instead of interrupting whatever thread at whatever
+// time. Only for the player: the other modes keep the default actions.
+// Must be called before any thread is created (the song loader's included).
+void block_handled_signals();
 
 #endif /* SIGNALS_HANDLER_HH_ */
@@ -0,0 +1,451 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib> // for getenv
+#include <cstring>
+#include <cinttypes> // for PRIx64
+#include <cstdio> // for rename and remove
+#include <fstream>
+#include <type_traits>
+
+#include "song_cache.hh"
+#include "mapped_file.hh"
+
+// to be increased whenever the layout of an entry, or the way songs are
+// decoded, changes: the entries of other versions are then ignored.
+static constexpr const uint32_t cache_version = 2;
+
+static constexpr const char cache_magic[8] = { 'p', 't', 'e', 'r', 'm', 's', 'n', 'g' };
+
+// the arrays of the song are stored as they are in memory
+static_assert(std::is_trivially_copyable<struct music_event>::value and
+	      std::is_trivially_copyable<midi_message>::value and
+	      std::is_trivially_copyable<struct key_data>::value,
+	      "the song arrays must be storable as they are");
+
+// and they have no padding bytes, which would make the hash of an entry
+// random
+static_assert((sizeof(struct music_event) == 24) and (sizeof(midi_message) == 4) and (sizeof(struct key_data) == 2),
+	      "the song arrays must not contain padding");
+
+// an entry is this header, followed by the pieces of the song, in order
+struct entry_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t path_hash; // of the name of the midi file
+    struct file_identity midi_file;
+    uint64_t nb_pieces;
+    uint64_t payload_hash; // of the arrays of all the pieces
+};
+
+static_assert(sizeof(struct file_identity) == 32, "the identity of a file must not contain padding");
+
+// a piece is this header, followed by its events, midi messages and key
+// events arrays. Its events point to its own midi messages and key events.
+struct piece_header
+{
+    uint64_t nb_events;
+    uint64_t nb_midi_messages;
+    uint64_t nb_key_events;
+};
+
+uint64_t content_hash(const uint8_t* data, std::size_t size)
+{
+  // multiply and rotate eight bytes at a time, then mix the bits of the
+  // result (the finalizer of murmurhash3)
+  constexpr const uint64_t k1 = 0x87c37b91114253d5;
+  constexpr const uint64_t k2 = 0x4cf5ad432745937f;
+
+  uint64_t res = 0x9e3779b97f4a7c15 ^ size;
+
+  std::size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    res ^= word * k1;
+    res = ((res << 31) | (res >> 33)) * k2;
+  }
+
+  uint64_t tail = 0;
+  for (; i < size; ++i)
+  {
+    tail = (tail << 8) | data[i];
+  }
+  res ^= tail * k1;
+
+  res ^= res >> 33;
+  res *= 0xff51afd7ed558ccd;
+  res ^= res >> 33;
+  res *= 0xc4ceb9fe1a85ec53;
+  res ^= res >> 33;
+
+  return res;
+}
+
+template <typename T>
+static uint64_t array_hash(const T* elts, std::size_t count)
+{
+  return content_hash(reinterpret_cast<const uint8_t*>(elts), count * sizeof(T));
+}
+
+static uint64_t piece_hash_of(const struct music_event* events, std::size_t nb_events,
+			      const midi_message* midi_messages, std::size_t nb_midi_messages,
+			      const struct key_data* key_events, std::size_t nb_key_events)
+{
+  return array_hash(events, nb_events) ^ (array_hash(midi_messages, nb_midi_messages) * 3) ^ (array_hash(key_events, nb_key_events) * 7);
+}
+
+// the hashes of the pieces are chained, so that their order matters too
+static uint64_t chain_hash(uint64_t hash, uint64_t piece_hash)
+{
+  return (((hash << 31) | (hash >> 33)) * 0x4cf5ad432745937f) ^ piece_hash;
+}
+
+static uint64_t path_hash_of(const std::string& midi_filename)
+{
+  return content_hash(reinterpret_cast<const uint8_t*>(midi_filename.data()), midi_filename.size());
+}
+
+static bool is_same_file(const struct file_identity& a, const struct file_identity& b)
+{
+  return (a.device == b.device) and (a.inode == b.inode) and (a.size == b.size) and
+    (a.modification_time == b.modification_time);
+}
+
+// creates the directory and its missing parents. Returns false on failure.
+static bool make_directories(const std::string& directory)
+{
+  for (auto pos = directory.find('/', 1); ; pos = directory.find('/', pos + 1))
+  {
+    const auto path = directory.substr(0, pos);
+    if ((mkdir(path.c_str(), 0755) == -1) and (errno != EEXIST))
+    {
+      return false;
+    }
+
+    if (pos == std::string::npos)
+    {
+      return true;
+    }
+  }
+}
+
+static std::string default_directory()
+{
+  const char* const xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+  if ((xdg_cache_home != nullptr) and (xdg_cache_home[0] == '/'))
+  {
+    return std::string{xdg_cache_home} + "/pianoterm";
+  }
+
+  const char* const home = std::getenv("HOME");
+  if ((home != nullptr) and (home[0] == '/'))
+  {
+    return std::string{home} + "/.cache/pianoterm";
+  }
+
+  return "";
+}
+
+// sanity check: the song must be one that group_events_by_time could have
+// produced, so that the player can trust it.
+static bool is_valid(const struct song& music)
+{
+  uint32_t midi_messages_end = 0;
+  uint32_t key_events_end = 0;
+
+  for (auto i = decltype(music.events.size()){0}; i < music.events.size(); ++i)
+  {
+    const auto& ev = music.events[i];
+    if (((i != 0) and (music.events[i - 1].time >= ev.time)) or
+	(ev.midi_messages_begin != midi_messages_end) or (ev.midi_messages_end < ev.midi_messages_begin) or
+	(ev.key_events_begin != key_events_end) or (ev.key_events_end < ev.key_events_begin))
+    {
+      return false;
+    }
+
+    midi_messages_end = ev.midi_messages_end;
+    key_events_end = ev.key_events_end;
+  }
+
+  if ((midi_messages_end != music.midi_messages.size()) or (key_events_end != music.key_events.size()))
+  {
+    return false;
+  }
+
+  for (const auto& message : music.midi_messages)
+  {
+    if ((message.size() == 0) or (message.size() > sizeof(message.bytes)))
+    {
+      return false;
+    }
+  }
+
+  for (const auto& key : music.key_events)
+  {
+    // an enum with an invalid value would be undefined behaviour
+    uint8_t ev_type;
+    std::memcpy(&ev_type, &key.ev_type, sizeof(ev_type));
+    if (ev_type > 1)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// appends count elements of the entry to elts. Returns false if the entry is
+// too short.
+template <typename T>
+static bool read_array(const uint8_t*& pos, const uint8_t* end, uint64_t count, std::vector<T>& elts)
+{
+  if (count > static_cast<uint64_t>(end - pos) / sizeof(T))
+  {
+    return false;
+  }
+
+  const auto first = elts.size();
+  elts.resize(first + count);
+  std::memcpy(static_cast<void*>(elts.data() + first), pos, count * sizeof(T));
+  pos += count * sizeof(T);
+  return true;
+}
+
+// appends the piece of the entry at pos to the song, and chains its hash to
+// payload_hash. Returns false if the entry is too short.
+static bool read_piece(const uint8_t*& pos, const uint8_t* end, struct song& music, uint64_t& payload_hash)
+{
+  if (static_cast<std::size_t>(end - pos) < sizeof(piece_header))
+  {
+    return false;
+  }
+
+  struct piece_header header;
+  std::memcpy(&header, pos, sizeof(header));
+  pos += sizeof(header);
+
+  const auto first_event = music.events.size();
+  const auto first_midi_message = music.midi_messages.size();
+  const auto first_key_event = music.key_events.size();
+
+  if ((not read_array(pos, end, header.nb_events, music.events)) or
+      (not read_array(pos, end, header.nb_midi_messages, music.midi_messages)) or
+      (not read_array(pos, end, header.nb_key_events, music.key_events)))
+  {
+    return false;
+  }
+
+  payload_hash = chain_hash(payload_hash, piece_hash_of(music.events.data() + first_event, header.nb_events,
+							 music.midi_messages.data() + first_midi_message, header.nb_midi_messages,
+							 music.key_events.data() + first_key_event, header.nb_key_events));
+
+  // what append_song does, the piece being already in place
+  const auto midi_messages_offset = static_cast<uint32_t>(first_midi_message);
+  const auto key_events_offset = static_cast<uint32_t>(first_key_event);
+  for (auto i = first_event; i < music.events.size(); ++i)
+  {
+    auto& ev = music.events[i];
+    ev.midi_messages_begin += midi_messages_offset;
+    ev.midi_messages_end += midi_messages_offset;
+    ev.key_events_begin += key_events_offset;
+    ev.key_events_end += key_events_offset;
+  }
+
+  return true;
+}
+
+template <typename T>
+static void write_array(std::ofstream& out, const std::vector<T>& elts)
+{
+  out.write(reinterpret_cast<const char*>(elts.data()), static_cast<std::streamsize>(elts.size() * sizeof(T)));
+}
+
+song_cache::song_cache()
+  : directory (default_directory())
+{
+}
+
+song_cache::song_cache(const std::string& init_directory)
+  : directory (init_directory)
+{
+}
+
+std::string song_cache::entry_path(const std::string& midi_filename, const struct file_identity& midi_file) const
+{
+  const auto hash = path_hash_of(midi_filename) ^
+    (content_hash(reinterpret_cast<const uint8_t*>(&midi_file), sizeof(midi_file)) * 3);
+
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016" PRIx64, hash);
+  return directory + "/" + name;
+}
+
+bool song_cache::load(const std::string& midi_filename, const struct file_identity& midi_file, struct song& music) const
+{
+  if (not is_enabled())
+  {
+    return false;
+  }
+
+  const mapped_file entry (entry_path(midi_filename, midi_file));
+  if ((not entry.is_open()) or (entry.size() < sizeof(entry_header)))
+  {
+    return false;
+  }
+
+  struct entry_header header;
+  std::memcpy(&header, entry.begin(), sizeof(header));
+
+  if ((std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0) or
+      (header.version != cache_version) or
+      (header.path_hash != path_hash_of(midi_filename)) or
+      (not is_same_file(header.midi_file, midi_file)))
+  {
+    return false;
+  }
+
+  struct song res;
+  uint64_t payload_hash = 0;
+  auto pos = entry.begin() + sizeof(header);
+  for (uint64_t i = 0; i < header.nb_pieces; ++i)
+  {
+    if (not read_piece(pos, entry.end(), res, payload_hash))
+    {
+      return false;
+    }
+  }
+
+  if ((pos != entry.end()) or (payload_hash != header.payload_hash) or (not is_valid(res)))
+  {
+    return false;
+  }
+
+  music = std::move(res);
+  return true;
+}
+
+song_cache_writer::song_cache_writer()
+  : midi_filename ()
+  , midi_file ()
+  , path ()
+  , tmp_path ()
+  , out ()
+  , nb_pieces (0)
+  , payload_hash (0)
+{
+}
+
+song_cache_writer::~song_cache_writer()
+{
+  discard();
+}
+
+void song_cache_writer::open(const song_cache& cache, const std::string& init_midi_filename, const struct file_identity& init_midi_file)
+{
+  if ((not cache.is_enabled()) or (not make_directories(cache.directory)))
+  {
+    return;
+  }
+
+  midi_filename = init_midi_filename;
+  midi_file = init_midi_file;
+
+  // written aside first, so that another pianoterm never reads a half
+  // written entry
+  path = cache.entry_path(midi_filename, midi_file);
+  tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+
+  // the header is only known once all the pieces are written, its place is
+  // kept until then
+  struct entry_header header;
+  std::memset(&header, 0, sizeof(header));
+
+  out.open(tmp_path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  if (out.fail())
+  {
+    discard();
+  }
+}
+
+void song_cache_writer::add_piece(const struct song& piece)
+{
+  if (not out.is_open())
+  {
+    return;
+  }
+
+  struct piece_header header;
+  header.nb_events = piece.events.size();
+  header.nb_midi_messages = piece.midi_messages.size();
+  header.nb_key_events = piece.key_events.size();
+
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  write_array(out, piece.events);
+  write_array(out, piece.midi_messages);
+  write_array(out, piece.key_events);
+
+  payload_hash = chain_hash(payload_hash, piece_hash_of(piece.events.data(), piece.events.size(),
+							 piece.midi_messages.data(), piece.midi_messages.size(),
+							 piece.key_events.data(), piece.key_events.size()));
+  ++nb_pieces;
+
+  // no need to write the rest of the song (the disk may be full)
+  if (out.fail())
+  {
+    discard();
+  }
+}
+
+void song_cache_writer::commit()
+{
+  if (not out.is_open())
+  {
+    return;
+  }
+
+  struct file_identity current;
+  if ((not identify_file(midi_filename, current)) or (not is_same_file(current, midi_file)))
+  {
+    discard();
+    return;
+  }
+
+  struct entry_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.path_hash = path_hash_of(midi_filename);
+  header.midi_file = midi_file;
+  header.nb_pieces = nb_pieces;
+  header.payload_hash = payload_hash;
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.close();
+
+  if (out.fail() or (std::rename(tmp_path.c_str(), path.c_str()) != 0))
+  {
+    discard();
+    return;
+  }
+
+  tmp_path.clear();
+}
+
+void song_cache_writer::discard()
+{
+  if (tmp_path.empty())
+  {
+    return;
+  }
+
+  out.close();
+  std::remove(tmp_path.c_str());
+  tmp_path.clear();
+}
@@ -0,0 +1,84 @@
+#ifndef SONG_CACHE_HH_
+#define SONG_CACHE_HH_
+
+#include <string>
+#include <fstream>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+#include "utils.hh"
+#include "mapped_file.hh"
+
+// 64 bits hash of some bytes. Not meant to resist someone crafting
+// collisions on purpose.
+uint64_t content_hash(const uint8_t* data, std::size_t size) __attribute__((pure));
+
+// songs already decoded, stored on disk in the layout of struct song, so that
+// opening a song again is a single read of its arrays.
+//
+// The entries are named after the path of their midi file, and its identity
+// (see struct file_identity): a file that changed simply gets another entry,
+// without having to read it. An entry written by another version of
+// pianoterm, or which is corrupted, is ignored.
+class song_cache
+{
+  public:
+    // the cache of the user: $XDG_CACHE_HOME/pianoterm, or
+    // $HOME/.cache/pianoterm. Disabled if none of these variables is set.
+    song_cache();
+
+    // an empty directory disables the cache
+    explicit song_cache(const std::string& directory);
+
+    bool is_enabled() const
+    {
+      return not directory.empty();
+    }
+
+    // returns false if there is no valid entry for this midi file
+    bool load(const std::string& midi_filename, const struct file_identity& midi_file, struct song& music) const;
+
+  private:
+    friend class song_cache_writer;
+
+    std::string entry_path(const std::string& midi_filename, const struct file_identity& midi_file) const;
+
+    std::string directory;
+};
+
+// writes the entry of a song piece by piece, while it is being decoded, so
+// that the whole song never has to be kept aside to be stored.
+//
+// Failing to store an entry is not an error, the song will just be decoded
+// again the next time. An entry which is not committed is discarded.
+class song_cache_writer
+{
+  public:
+    song_cache_writer();
+    ~song_cache_writer();
+
+    song_cache_writer(const song_cache_writer&) = delete;
+    song_cache_writer& operator=(const song_cache_writer&) = delete;
+
+    void open(const song_cache& cache, const std::string& midi_filename, const struct file_identity& midi_file);
+
+    // the pieces must come in the order of the song
+    void add_piece(const struct song& piece);
+
+    // makes the entry available, unless the midi file changed since it was
+    // opened: the song decoded might then not be the one of the file anymore.
+    void commit();
+
+  private:
+    void discard();
+
+    std::string midi_filename;
+    struct file_identity midi_file;
+    std::string path;
+    std::string tmp_path;
+    std::ofstream out;
+    uint64_t nb_pieces;
+    uint64_t payload_hash;
+};
+
+#endif /* SONG_CACHE_HH_ */
@@ -0,0 +1,107 @@
+#include <algorithm>
+
+#include "song_checkpoints.hh"
+
+// a checkpoint takes a bit more than 2KiB: one every 1024 music events keeps
+// the memory overhead in the same range as the song itself, while seeking
+// never replays more than 1024 music events.
+static constexpr const std::size_t interval = 1024;
+
+void playback_state::apply(const midi_message& message)
+{
+  if (message.size() == 0)
+  {
+    return;
+  }
+
+  const auto channel = message[0] & 0x0Fu;
+
+  if (is_key_down_event(message))
+  {
+    velocities[channel][message[1] & 0x7Fu] = message[2];
+    return;
+  }
+
+  if (is_key_release_event(message))
+  {
+    velocities[channel][message[1] & 0x7Fu] = 0;
+    return;
+  }
+
+  // program change
+  if (((message[0] & 0xF0) == 0xC0) and (message.size() == 2))
+  {
+    programs[channel] = message[1];
+    has_program.set(channel);
+  }
+}
+
+void playback_state::apply(const struct key_data& key)
+{
+  pressed_keys.set(key.pitch, key.ev_type == key_data::type::pressed);
+}
+
+void playback_state::apply(const struct song& music, const struct music_event& ev)
+{
+  for (const auto& message : music.midi_messages_of(ev))
+  {
+    apply(message);
+  }
+
+  for (const auto& key : music.key_events_of(ev))
+  {
+    apply(key);
+  }
+}
+
+song_checkpoints::song_checkpoints(const struct song& init_music)
+  : music (init_music)
+  , states ()
+  , last_state ()
+  , nb_applied_events (0)
+{
+  extend();
+}
+
+void song_checkpoints::extend()
+{
+  states.reserve(music.events.size() / interval + 1);
+
+  for (; nb_applied_events < music.events.size(); ++nb_applied_events)
+  {
+    if (nb_applied_events % interval == 0)
+    {
+      states.push_back(last_state);
+    }
+    last_state.apply(music, music.events[nb_applied_events]);
+  }
+}
+
+std::size_t song_checkpoints::event_at(std::chrono::nanoseconds song_time) const
+{
+  const auto ev = std::lower_bound(music.events.begin(), music.events.end(), song_time,
+				   [] (const struct music_event& event, std::chrono::nanoseconds time) {
+				     return event.time < time;
+				   });
+
+  return static_cast<std::size_t>(ev - music.events.begin());
+}
+
+struct playback_state song_checkpoints::state_before(std::size_t event_index) const
+{
+  if (states.empty())
+  {
+    return playback_state();
+  }
+
+  const auto checkpoint = std::min(event_index / interval, states.size() - 1);
+
+  auto res = states[checkpoint];
+  const auto end = std::min(event_index, music.events.size());
+  for (auto i = checkpoint * interval; i < end; ++i)
+  {
+    res.apply(music, music.events[i]);
+  }
+
+  return res;
+}
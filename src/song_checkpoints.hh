@@ -0,0 +1,65 @@
+#ifndef SONG_CHECKPOINTS_HH_
+#define SONG_CHECKPOINTS_HH_
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <vector>
+#include <cstddef> // for std::size_t
+#include <cstdint>
+
+#include "utils.hh"
+
+// what the playback left behind after some music events: the notes still
+// sounding, the instruments chosen, and the keys shown as pressed. Starting
+// to play from any event only requires going from the current state to the
+// one right before that event.
+struct playback_state
+{
+    std::array<std::array<uint8_t, 128>, 16> velocities; // per channel and pitch, 0 if the note is not sounding
+    std::array<uint8_t, 16> programs; // per channel, only meaningful if has_program is set
+    std::bitset<16> has_program;
+    std::bitset<256> pressed_keys;
+
+    playback_state()
+      : velocities ()
+      , programs ()
+      , has_program ()
+      , pressed_keys ()
+    {
+    }
+
+    void apply(const midi_message& message);
+    void apply(const struct key_data& key);
+    void apply(const struct song& music, const struct music_event& ev);
+};
+
+// snapshots of the playback state taken every few music events, to seek
+// anywhere in a song in a time which doesn't depend on the song length.
+class song_checkpoints
+{
+  public:
+    explicit song_checkpoints(const struct song& music);
+
+    // takes the checkpoints of the music events appended to the song since
+    // the last call
+    void extend();
+
+    song_checkpoints(const song_checkpoints&) = delete;
+    song_checkpoints& operator=(const song_checkpoints&) = delete;
+
+    // index of the first music event occuring at or after the given song
+    // time. Returns the number of events if there is none.
+    std::size_t event_at(std::chrono::nanoseconds song_time) const __attribute__((pure));
+
+    // the playback state right before playing the given music event
+    struct playback_state state_before(std::size_t event_index) const __attribute__((pure));
+
+  private:
+    const struct song& music;
+    std::vector<struct playback_state> states; // states[i] is the state right before the music event i * interval
+    struct playback_state last_state; // the state after the events known so far
+    std::size_t nb_applied_events;
+};
+
+#endif /* SONG_CHECKPOINTS_HH_ */
@@ -0,0 +1,247 @@
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include "song_loader.hh"
+
+// the first piece only covers the first moments of the song, the next ones
+// are twice as long as the previous, up to max_window.
+static constexpr const std::chrono::milliseconds first_window { 250 };
+static constexpr const std::chrono::milliseconds max_window { 8000 };
+
+// pieces loaded in advance. Beyond that, the loading waits for the player.
+static constexpr const std::size_t max_pending_pieces = 4;
+
+song_loader::song_loader(const std::string& init_filename, const song_cache& init_cache)
+  : filename (init_filename)
+  , stream (filename)
+  , cache (init_cache)
+  , extractor ()
+  , mutex ()
+  , piece_pushed ()
+  , piece_taken ()
+  , pieces ()
+  , stop_required (false)
+  , waits_stopped (false)
+  , stream_done (false)
+  , error ()
+  , thread ()
+{
+  thread = std::thread(&song_loader::run, this);
+}
+
+song_loader::~song_loader()
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    stop_required = true;
+  }
+  piece_taken.notify_all();
+
+  if (thread.joinable())
+  {
+    thread.join();
+  }
+}
+
+bool song_loader::next_piece(struct song& piece)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  piece_pushed.wait(lock, [this] () {
+      return is_wait_over();
+    });
+
+  return take_piece(lock, piece);
+}
+
+bool song_loader::next_piece(struct song& piece, std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  piece_pushed.wait_for(lock, timeout, [this] () {
+      return is_wait_over();
+    });
+
+  return take_piece(lock, piece);
+}
+
+void song_loader::stop_waiting()
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    waits_stopped = true;
+  }
+  piece_pushed.notify_all();
+}
+
+bool song_loader::take_piece(std::unique_lock<std::mutex>& lock, struct song& piece)
+{
+  if (waits_stopped)
+  {
+    return false;
+  }
+
+  if (pieces.empty())
+  {
+    if (stream_done and error)
+    {
+      std::rethrow_exception(error);
+    }
+    return false;
+  }
+
+  piece = std::move(pieces.front());
+  pieces.pop_front();
+
+  lock.unlock();
+  piece_taken.notify_all();
+  return true;
+}
+
+bool song_loader::is_done() const
+{
+  std::lock_guard<std::mutex> lock (mutex);
+  return stream_done and pieces.empty() and (not error);
+}
+
+bool song_loader::push_piece(struct song&& piece)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  piece_taken.wait(lock, [this] () {
+      return (pieces.size() < max_pending_pieces) or stop_required;
+    });
+
+  if (stop_required)
+  {
+    return false;
+  }
+
+  pieces.push_back(std::move(piece));
+
+  lock.unlock();
+  piece_pushed.notify_all();
+  return true;
+}
+
+void song_loader::run()
+{
+  try
+  {
+    load();
+  }
+  catch (...)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    error = std::current_exception();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    stream_done = true;
+  }
+  piece_pushed.notify_all();
+}
+
+void song_loader::load()
+{
+  // the pieces are stored in the cache as they are decoded
+  song_cache_writer cache_entry;
+
+  struct file_identity midi_file;
+  if (cache.is_enabled() and stream.identify(midi_file))
+  {
+    struct song cached;
+    if (cache.load(filename, midi_file, cached))
+    {
+      push_piece(std::move(cached));
+      return;
+    }
+
+    cache_entry.open(cache, filename, midi_file);
+  }
+
+  // the events read, but not grouped into a piece yet. The key events are
+  // kept sorted by time.
+  std::vector<struct midi_event> midi_events;
+  std::vector<struct key_event> key_events;
+
+  uint64_t nb_pressed = 0;
+  uint64_t nb_released = 0;
+
+  std::chrono::nanoseconds limit { 0 };
+  std::chrono::nanoseconds window { first_window };
+  bool has_more = true;
+
+  while (has_more)
+  {
+    limit += window;
+    window = std::min(window * 2, std::chrono::nanoseconds{ max_window });
+
+    const auto first_new_midi_event = midi_events.size();
+    has_more = stream.read_until(limit, midi_events);
+
+    const auto first_new_key_event = key_events.size();
+    extractor.extract(midi_events.data() + first_new_midi_event, midi_events.data() + midi_events.size(), stream.tempo(), key_events);
+
+    // the new key events are not sorted (some release events got advanced),
+    // but almost. Events occuring at the same time keep their relative
+    // order, as if the song was loaded at once.
+    const auto new_key_events = key_events.begin() + static_cast<std::ptrdiff_t>(first_new_key_event);
+    const auto by_time = [] (const struct key_event& a, const struct key_event& b) {
+      return a.time < b.time;
+    };
+    std::stable_sort(new_key_events, key_events.end(), by_time);
+    std::inplace_merge(key_events.begin(), new_key_events, key_events.end(), by_time);
+
+    // the events read next can still advance release events up to
+    // max_release_advance before the limit. The ones before are final.
+    const auto final_limit = has_more ? limit - key_events_extractor::max_release_advance
+				      : std::chrono::nanoseconds::max();
+
+    const auto& tempo = stream.tempo();
+    const auto midi_end = std::find_if(midi_events.begin(), midi_events.end(), [&] (const struct midi_event& ev) {
+	return tempo.time_of(ev.tick) >= final_limit;
+      });
+    const auto key_end = std::find_if(key_events.begin(), key_events.end(), [=] (const struct key_event& ev) {
+	return ev.time >= final_limit;
+      });
+
+    if ((midi_end == midi_events.begin()) and (key_end == key_events.begin()))
+    {
+      continue;
+    }
+
+    for (auto it = key_events.begin(); it != key_end; ++it)
+    {
+      if (it->data.ev_type == key_data::type::pressed)
+      {
+	nb_pressed++;
+      }
+      else
+      {
+	nb_released++;
+      }
+    }
+
+    auto piece = group_sorted_events_by_time(array_view<struct midi_event>{ midi_events.data(), midi_events.data() + (midi_end - midi_events.begin()) },
+					     array_view<struct key_event>{ key_events.data(), key_events.data() + (key_end - key_events.begin()) },
+					     tempo);
+
+    midi_events.erase(midi_events.begin(), midi_end);
+    key_events.erase(key_events.begin(), key_end);
+
+    cache_entry.add_piece(piece);
+
+    if (not push_piece(std::move(piece)))
+    {
+      return;
+    }
+  }
+
+  // sanity check: there must be as many release events as pressed events
+  if (nb_pressed != nb_released)
+  {
+    throw std::invalid_argument("Error: mismatch between key pressed and key release");
+  }
+
+  cache_entry.commit();
+}
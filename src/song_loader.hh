@@ -0,0 +1,84 @@
+#ifndef SONG_LOADER_HH_
+#define SONG_LOADER_HH_
+
+#include <string>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "midi_reader.hh"
+#include "keyboard_events_extractor.hh"
+#include "utils.hh"
+#include "song_cache.hh"
+
+// loads a song in the background, from its beginning to its end, one piece
+// after the other, so that it can be played before the whole file is
+// decoded. The first pieces are short ones, to start playing right away, the
+// following ones get longer to reduce the overhead.
+//
+// Errors in the file header are reported by the constructor, the others by
+// next_piece once the pieces before the error have been taken.
+//
+// A song found in the cache is given as a single piece. The others are
+// stored in the cache while they are loaded, and kept there once entirely
+// loaded.
+class song_loader
+{
+  public:
+    song_loader(const std::string& filename, const song_cache& cache);
+    ~song_loader();
+
+    song_loader(const song_loader&) = delete;
+    song_loader& operator=(const song_loader&) = delete;
+
+    // waits for the next piece of the song. Returns false if the whole
+    // song has been loaded already, or once stop_waiting has been called.
+    bool next_piece(struct song& piece);
+
+    // same, waiting up to timeout: also returns false if there is no piece
+    // yet.
+    bool next_piece(struct song& piece, std::chrono::milliseconds timeout);
+
+    // wakes up whoever waits for a piece (the player being stopped), and
+    // makes next_piece return false from now on.
+    void stop_waiting();
+
+    // true once all the pieces of the song have been taken
+    bool is_done() const;
+
+  private:
+    void run();
+    void load();
+
+    // returns false if the loading must stop
+    bool push_piece(struct song&& piece);
+
+    // what next_piece does once it waited
+    bool take_piece(std::unique_lock<std::mutex>& lock, struct song& piece);
+
+    // there is a piece to take, or there won't be any
+    bool is_wait_over() const
+    {
+      return (not pieces.empty()) or stream_done or waits_stopped;
+    }
+
+    const std::string filename;
+    midi_event_stream stream;
+    const song_cache cache;
+    key_events_extractor extractor;
+
+    mutable std::mutex mutex;
+    std::condition_variable piece_pushed;
+    std::condition_variable piece_taken;
+    std::deque<struct song> pieces;
+    bool stop_required;
+    bool waits_stopped;
+    bool stream_done;
+    std::exception_ptr error;
+    std::thread thread;
+};
+
+#endif /* SONG_LOADER_HH_ */
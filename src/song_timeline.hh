@@ -0,0 +1,61 @@
+#ifndef SONG_TIMELINE_HH_
+#define SONG_TIMELINE_HH_
+
+#include <chrono>
+
+// maps the song time to the playback clock time. Every music event is due
+// at an absolute deadline computed from the song start, so the time spent
+// drawing or in system calls doesn't add up over the song. A pause shifts
+// the song start instead, and so does a speed change, so that the song
+// continues from where it was.
+struct song_timeline
+{
+    std::chrono::nanoseconds origin; // clock time of the song time 0
+    bool is_paused;
+    std::chrono::nanoseconds pause_start; // clock time, when paused
+    unsigned int speed; // in percents of the normal speed
+
+    std::chrono::nanoseconds deadline_of(std::chrono::nanoseconds song_time) const
+    {
+      return origin + song_time * 100 / speed;
+    }
+
+    void pause(std::chrono::nanoseconds now)
+    {
+      if (not is_paused)
+      {
+	is_paused = true;
+	pause_start = now;
+      }
+    }
+
+    void resume(std::chrono::nanoseconds now)
+    {
+      if (is_paused)
+      {
+	is_paused = false;
+	origin += now - pause_start;
+      }
+    }
+
+    std::chrono::nanoseconds song_time_at(std::chrono::nanoseconds now) const
+    {
+      return ((is_paused ? pause_start : now) - origin) * speed / 100;
+    }
+
+    // the song continues from the given song time, paused or not
+    void move_to(std::chrono::nanoseconds song_time, std::chrono::nanoseconds now)
+    {
+      origin = now - song_time * 100 / speed;
+      pause_start = now;
+    }
+
+    void set_speed(unsigned int new_speed, std::chrono::nanoseconds now)
+    {
+      const auto current_time = song_time_at(now);
+      speed = new_speed;
+      move_to(current_time, now);
+    }
+};
+
+#endif /* SONG_TIMELINE_HH_ */
@@ -0,0 +1,63 @@
+#ifndef SPSC_RING_HH_
+#define SPSC_RING_HH_
+
+#include <array>
+#include <atomic>
+#include <cstddef> // for std::size_t
+
+// lock-free ring buffer between exactly one producer thread and one consumer
+// thread. Neither side ever blocks: pushing in a full ring or popping from
+// an empty one simply fails.
+template <typename T, std::size_t capacity>
+class spsc_ring
+{
+    static_assert((capacity != 0) and ((capacity & (capacity - 1)) == 0), "the capacity must be a power of two");
+
+  public:
+    spsc_ring()
+      : elts ()
+      , head (0)
+      , tail (0)
+    {
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // producer side. Returns false if the ring is full.
+    bool push(const T& elt)
+    {
+      const auto pos = tail.load(std::memory_order_relaxed);
+      if (pos - head.load(std::memory_order_acquire) == capacity)
+      {
+	return false;
+      }
+
+      elts[pos % capacity] = elt;
+      tail.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // consumer side. Returns false if the ring is empty.
+    bool pop(T& elt)
+    {
+      const auto pos = head.load(std::memory_order_relaxed);
+      if (pos == tail.load(std::memory_order_acquire))
+      {
+	return false;
+      }
+
+      elt = elts[pos % capacity];
+      head.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::array<T, capacity> elts;
+
+    // on separate cache lines, as each one is written by a different thread
+    alignas(64) std::atomic<std::size_t> head; // next element to pop
+    alignas(64) std::atomic<std::size_t> tail; // next element to push
+};
+
+#endif /* SPSC_RING_HH_ */
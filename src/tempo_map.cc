@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+#include "tempo_map.hh"
+
+// default tempo is 120 beats per minutes
+// 1 minute -> 60 000 000 microseconds
+// 60000000 / 120 -> 500 000 microseconds per quarter note
+static constexpr const uint64_t default_us_per_quarter_note = 500000;
+
+// the products below stay far from overflowing: a remainder is less than a
+// unit (at most 2^24 microseconds, so less than 2^34 nanoseconds), and
+// tickdiv is at most 2^16.
+static uint64_t ticks_to_ns(uint64_t nb_ticks, uint64_t unit_duration, uint64_t tickdiv)
+{
+  return ((nb_ticks / tickdiv) * unit_duration) + (((nb_ticks % tickdiv) * unit_duration) / tickdiv);
+}
+
+// the opposite: the last number of ticks n for which ticks_to_ns(n) <= duration,
+// that is n * unit_duration < (duration + 1) * tickdiv. With
+// duration + 1 = q * unit_duration + r, n is q * tickdiv + ceil(r * tickdiv /
+// unit_duration) - 1, the last term staying below 2^50. The ticks of an
+// absurd duration saturate instead of overflowing.
+static uint64_t ns_to_ticks(uint64_t duration, uint64_t unit_duration, uint64_t tickdiv)
+{
+  const auto q = (duration / unit_duration) + (((duration % unit_duration) + 1) / unit_duration);
+  const auto r = ((duration % unit_duration) + 1) % unit_duration;
+
+  if (q > (std::numeric_limits<uint64_t>::max() - tickdiv) / tickdiv)
+  {
+    return std::numeric_limits<uint64_t>::max();
+  }
+
+  return (q * tickdiv) + (((r * tickdiv) + unit_duration - 1) / unit_duration) - 1;
+}
+
+tempo_map::tempo_map()
+  : tempo_map(1, tempo_style::metrical_timing)
+{
+}
+
+tempo_map::tempo_map(uint16_t init_tickdiv, enum tempo_style init_timing_type)
+  : timing_type (init_timing_type)
+  , tickdiv (init_tickdiv)
+  , segments ()
+{
+  if (tickdiv == 0)
+  {
+    throw std::invalid_argument("Error: a quarter note is made of 0 pulses (which is impossible) according to the midi data");
+  }
+
+  switch (timing_type)
+  {
+    case tempo_style::metrical_timing:
+      segments.push_back({ 0, std::chrono::nanoseconds{ 0 }, default_us_per_quarter_note * 1000 });
+      break;
+
+    case tempo_style::timecode:
+      segments.push_back({ 0, std::chrono::nanoseconds{ 0 }, 1000 * 1000 * 1000 });
+      break;
+
+#if !defined(__clang__)
+    // clang will complain that the default case is useless because all
+    // possible values in the enum are already taken into account.
+    // g++ complains of a missing one
+    default:
+      __builtin_unreachable();
+      break;
+#endif
+  }
+}
+
+void tempo_map::add_tempo_change(uint64_t tick, uint32_t us_per_quarter_note)
+{
+  if (timing_type == tempo_style::timecode)
+  {
+    return;
+  }
+
+  if (us_per_quarter_note == 0)
+  {
+    // every note of the song would be played at once
+    throw std::invalid_argument("Error: a quarter note lasts 0 microseconds (which is impossible) according to the midi data");
+  }
+
+  auto& last = segments.back();
+  if (tick < last.start_tick)
+  {
+    throw std::runtime_error("Error: the tempo changes are not sorted.");
+  }
+
+  const uint64_t unit_duration = uint64_t{ us_per_quarter_note } * 1000;
+  if (tick == last.start_tick)
+  {
+    // the previous tempo lasted 0 tick
+    last.unit_duration = unit_duration;
+    return;
+  }
+
+  segments.push_back({ tick, time_of(tick), unit_duration });
+}
+
+std::chrono::nanoseconds tempo_map::time_of(uint64_t tick) const
+{
+  // the last segment starting at or before tick
+  const auto next = std::upper_bound(segments.begin(), segments.end(), tick,
+				     [] (uint64_t t, const struct segment& s) {
+				       return t < s.start_tick;
+				     });
+  const auto& seg = *(next - 1);
+
+  const auto elapsed = ticks_to_ns(tick - seg.start_tick, seg.unit_duration, tickdiv);
+  return seg.start_time + std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(elapsed) };
+}
+
+uint64_t tempo_map::tick_of(std::chrono::nanoseconds time) const
+{
+  if (time.count() < 0)
+  {
+    throw std::invalid_argument("Error: no tick occurs before the beginning of the song");
+  }
+
+  // the last segment starting at or before time. The first one starts at 0.
+  const auto next = std::upper_bound(segments.begin(), segments.end(), time,
+				     [] (std::chrono::nanoseconds t, const struct segment& s) {
+				       return t < s.start_time;
+				     });
+  const auto& seg = *(next - 1);
+
+  const auto ticks = ns_to_ticks(static_cast<uint64_t>((time - seg.start_time).count()), seg.unit_duration, tickdiv);
+  return (ticks > std::numeric_limits<uint64_t>::max() - seg.start_tick) ? std::numeric_limits<uint64_t>::max()
+									  : seg.start_tick + ticks;
+}
@@ -0,0 +1,49 @@
+#ifndef TEMPO_MAP_HH_
+#define TEMPO_MAP_HH_
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+enum tempo_style : bool
+{
+  metrical_timing, // ticks per quarter note, the duration of a quarter note being set by tempo events
+  timecode, // ticks per second
+};
+
+// converts the midi ticks of a song to song time, and back. The song is cut
+// into segments of constant tempo, each one knowing the song time it starts
+// at, so a conversion is a binary search on the segments followed by exact
+// integer maths.
+class tempo_map
+{
+  public:
+    tempo_map();
+    tempo_map(uint16_t tickdiv, enum tempo_style timing_type);
+
+    // the tempo changes must be added in tick order. Does nothing on
+    // timecode songs, whose tick duration never changes. A tempo of 0
+    // is rejected.
+    void add_tempo_change(uint64_t tick, uint32_t us_per_quarter_note);
+
+    std::chrono::nanoseconds time_of(uint64_t tick) const __attribute__((pure));
+
+    // the last tick occuring at or before the given song time, which must
+    // not be negative: time_of(tick) > time if and only if tick > tick_of(time).
+    // Only the tempo changes added so far are taken into account.
+    uint64_t tick_of(std::chrono::nanoseconds time) const;
+
+  private:
+    struct segment
+    {
+	uint64_t start_tick;
+	std::chrono::nanoseconds start_time;
+	uint64_t unit_duration; // in nanoseconds, a unit being tickdiv ticks
+    };
+
+    enum tempo_style timing_type;
+    uint16_t tickdiv;
+    std::vector<struct segment> segments; // sorted by start_tick (and so by start_time)
+};
+
+#endif /* TEMPO_MAP_HH_ */
@@ -0,0 +1,153 @@
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "check.hh"
+
+static unsigned int nb_failures = 0;
+
+void check(bool condition, const char* expression, const char* file, int line)
+{
+  if (not condition)
+  {
+    nb_failures++;
+    std::cerr << file << ':' << line << ": check failed: " << expression << '\n';
+  }
+}
+
+void run_test(const char* name, void (*test)())
+{
+  const auto failures_before = nb_failures;
+  try
+  {
+    test();
+  }
+  catch (std::exception& e)
+  {
+    nb_failures++;
+    std::cerr << name << ": unexpected exception: " << e.what() << '\n';
+  }
+
+  std::cout << ((nb_failures == failures_before) ? "ok     " : "FAILED ") << name << std::endl;
+}
+
+unsigned int nb_failed_checks()
+{
+  return nb_failures;
+}
+
+std::string fixture_path(const std::string& name)
+{
+  return "tests/fixtures/" + name;
+}
+
+// The .mid fixtures were written by midi_corpus:
+//   tempo_changes.mid: --notes 400 --tracks 6 --density 50 --polyphony 4 --tempo-changes 3 --sysex 16 --seed 7
+//   dense.mid: --notes 400 --tracks 16 --density 2000 --polyphony 8 --no-running-status --seed 3
+// and single_track.mid (format 0) by playing tempo_changes.mid with
+// --bench --backend file.
+//
+// Their .expected files hold the songs decoded by the first version of
+// pianoterm (fstream parser, stable sort of all the events, naive key
+// events extraction and grouping), written with describe(). Timecode files
+// are left out: that version got their timing wrong.
+std::vector<struct regression_fixture> regression_fixtures()
+{
+  return {
+    { fixture_path("tempo_changes.mid"), fixture_path("tempo_changes.expected") },
+    { fixture_path("dense.mid"), fixture_path("dense.expected") },
+    { fixture_path("single_track.mid"), fixture_path("single_track.expected") },
+    { "../misc/Hanon_exercice2.midi", fixture_path("Hanon_exercice2.expected") },
+  };
+}
+
+std::string read_file(const std::string& filename)
+{
+  std::ifstream in (filename, std::ios::binary);
+  if (not in)
+  {
+    throw std::runtime_error("Error: can't read " + filename);
+  }
+
+  std::ostringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+void write_file(const std::string& filename, const std::string& content)
+{
+  std::ofstream out (filename, std::ios::binary | std::ios::trunc);
+  out.write(content.data(), static_cast<std::streamsize>(content.size()));
+  if (not out)
+  {
+    throw std::runtime_error("Error: can't write " + filename);
+  }
+}
+
+std::string describe(const struct song& music)
+{
+  std::string res;
+  char hex[3];
+  for (const auto& ev : music.events)
+  {
+    res += std::to_string(ev.time.count());
+    for (const auto& message : music.midi_messages_of(ev))
+    {
+      res += ' ';
+      for (const auto byte : message)
+      {
+	std::snprintf(hex, sizeof(hex), "%02x", byte);
+	res += hex;
+      }
+    }
+
+    for (const auto& key : music.key_events_of(ev))
+    {
+      res += ' ';
+      res += (key.ev_type == key_data::type::pressed) ? 'p' : 'r';
+      res += std::to_string(unsigned{ key.pitch });
+    }
+    res += '\n';
+  }
+
+  return res;
+}
+
+temporary_directory::temporary_directory()
+  : dir ()
+{
+  const char* tmpdir = std::getenv("TMPDIR");
+  std::string pattern = std::string((tmpdir != nullptr) ? tmpdir : "/tmp") + "/pianoterm_tests.XXXXXX";
+  std::vector<char> name (pattern.begin(), pattern.end());
+  name.push_back('\0');
+  if (mkdtemp(name.data()) == nullptr)
+  {
+    throw std::runtime_error("Error: can't create a temporary directory");
+  }
+
+  dir = name.data();
+}
+
+temporary_directory::~temporary_directory()
+{
+  DIR* d = opendir(dir.c_str());
+  if (d != nullptr)
+  {
+    while (const struct dirent* entry = readdir(d))
+    {
+      const std::string name = entry->d_name;
+      if ((name != ".") and (name != ".."))
+      {
+	unlink((dir + '/' + name).c_str());
+      }
+    }
+    closedir(d);
+  }
+
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,85 @@
+#ifndef CHECK_HH_
+#define CHECK_HH_
+
+#include <string>
+#include <vector>
+
+#include "utils.hh"
+
+// a failed check is reported and the test goes on, so that make check shows
+// all the failures at once.
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+// the statement must throw an exception of the given type
+#define CHECK_THROWS(statement, exception_type)				\
+  do									\
+  {									\
+    bool has_thrown = false;						\
+    try									\
+    {									\
+      statement;							\
+    }									\
+    catch (exception_type&)						\
+    {									\
+      has_thrown = true;						\
+    }									\
+    check(has_thrown, #statement " throws " #exception_type, __FILE__, __LINE__); \
+  }									\
+  while (false)
+
+void check(bool condition, const char* expression, const char* file, int line);
+
+// an exception escaping the test counts as a failure
+void run_test(const char* name, void (*test)());
+
+unsigned int nb_failed_checks() __attribute__((pure));
+
+// the tests are run from the src directory, by make check
+std::string fixture_path(const std::string& name);
+
+// a midi file, and the song the first version of pianoterm decoded from it
+struct regression_fixture
+{
+    std::string midi_file;
+    std::string expected_song;
+};
+
+std::vector<struct regression_fixture> regression_fixtures();
+
+std::string read_file(const std::string& filename);
+void write_file(const std::string& filename, const std::string& content);
+
+// one line per music event: its time in nanoseconds, its midi messages in
+// hexadecimal, then its key events (p or r, and the pitch)
+std::string describe(const struct song& music);
+
+// a directory removed with its files once the test is over
+class temporary_directory
+{
+  public:
+    temporary_directory();
+    ~temporary_directory();
+
+    temporary_directory(const temporary_directory&) = delete;
+    temporary_directory& operator=(const temporary_directory&) = delete;
+
+    const std::string& path() const
+    {
+      return dir;
+    }
+
+  private:
+    std::string dir;
+};
+
+// the tests of each module
+void run_midi_reader_tests();
+void run_song_timeline_tests();
+void run_frame_keys_coalescer_tests();
+void run_song_checkpoints_tests();
+void run_tempo_map_tests();
+void run_song_loader_tests();
+void run_pipe_tests();
+void run_song_cache_tests();
+
+#endif /* CHECK_HH_ */
@@ -0,0 +1,73 @@
+#include <string>
+#include <vector>
+#include "check.hh"
+#include "frame_keys_coalescer.hh"
+
+// plays the key events (p or r, and the pitch), then gives the ones of the
+// next frame, in the same notation
+static std::string next_frame(frame_keys_coalescer& coalescer, key_events_ring& played_keys,
+			      const std::vector<std::string>& played)
+{
+  for (const auto& key : played)
+  {
+    played_keys.push(key_data(static_cast<uint8_t>(std::stoi(key.substr(1))),
+			      (key[0] == 'p') ? key_data::type::pressed : key_data::type::released));
+  }
+
+  std::vector<struct key_data> frame_keys;
+  coalescer.next_frame(played_keys, frame_keys);
+
+  std::string res;
+  for (const auto& key : frame_keys)
+  {
+    res += res.empty() ? "" : " ";
+    res += (key.ev_type == key_data::type::pressed) ? 'p' : 'r';
+    res += std::to_string(unsigned{ key.pitch });
+  }
+
+  return res;
+}
+
+static void keys_are_shown_in_play_order()
+{
+  frame_keys_coalescer coalescer;
+  key_events_ring played_keys;
+
+  CHECK(next_frame(coalescer, played_keys, { "p60", "r62", "p64" }) == "p60 r62 p64");
+  CHECK(not coalescer.has_postponed_releases());
+  CHECK(next_frame(coalescer, played_keys, {}) == "");
+}
+
+// a key pressed and released in the same frame is shown pressed for a frame
+static void short_presses_are_shown_for_a_frame()
+{
+  frame_keys_coalescer coalescer;
+  key_events_ring played_keys;
+
+  CHECK(next_frame(coalescer, played_keys, { "p60", "r60", "p62" }) == "p60 p62");
+  CHECK(coalescer.has_postponed_releases());
+  CHECK(next_frame(coalescer, played_keys, { "r62" }) == "r60 r62");
+  CHECK(not coalescer.has_postponed_releases());
+
+  // pressed again in the next frame: the release still comes first
+  CHECK(next_frame(coalescer, played_keys, { "p60", "r60" }) == "p60");
+  CHECK(next_frame(coalescer, played_keys, { "p60" }) == "r60 p60");
+}
+
+// a key pressed again in the frame it was released in stays pressed
+static void a_press_cancels_the_postponed_release()
+{
+  frame_keys_coalescer coalescer;
+  key_events_ring played_keys;
+
+  CHECK(next_frame(coalescer, played_keys, { "p60", "r60", "p60" }) == "p60 p60");
+  CHECK(next_frame(coalescer, played_keys, {}) == "");
+  CHECK(next_frame(coalescer, played_keys, { "r60" }) == "r60");
+}
+
+void run_frame_keys_coalescer_tests()
+{
+  run_test("keys are shown in play order", keys_are_shown_in_play_order);
+  run_test("short presses are shown for a frame", short_presses_are_shown_for_a_frame);
+  run_test("a press cancels the postponed release", a_press_cancels_the_postponed_release);
+}
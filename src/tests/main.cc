@@ -0,0 +1,22 @@
+#include <iostream>
+#include "check.hh"
+
+int main()
+{
+  run_midi_reader_tests();
+  run_song_timeline_tests();
+  run_frame_keys_coalescer_tests();
+  run_song_checkpoints_tests();
+  run_tempo_map_tests();
+  run_song_loader_tests();
+  run_pipe_tests();
+  run_song_cache_tests();
+
+  if (nb_failed_checks() != 0)
+  {
+    std::cerr << nb_failed_checks() << " checks failed\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "check.hh"
+#include "midi_reader.hh"
+#include "keyboard_events_extractor.hh"
+#include "utils.hh"
+
+static struct song load_song(const std::string& filename, enum track_decoding decoding)
+{
+  class tempo_map tempo;
+  const auto midi_events = get_midi_events(filename, tempo, decoding);
+  const auto key_events = get_key_events(midi_events, tempo);
+  return group_events_by_time(midi_events, key_events, tempo);
+}
+
+static void songs_match_the_first_version()
+{
+  for (const auto& fixture : regression_fixtures())
+  {
+    const auto expected = read_file(fixture.expected_song);
+    CHECK(describe(load_song(fixture.midi_file, parallel_decoding)) == expected);
+    CHECK(describe(load_song(fixture.midi_file, sequential_decoding)) == expected);
+  }
+}
+
+static bool is_same_message(const midi_message& a, const midi_message& b)
+{
+  return (a.size() == b.size()) and std::equal(a.begin(), a.end(), b.begin());
+}
+
+// the tracks are merged in tick order, the events of a same tick in track
+// order, whatever the decoding
+static void tracks_are_merged_in_tick_order()
+{
+  for (const auto& fixture : regression_fixtures())
+  {
+    class tempo_map parallel_tempo;
+    class tempo_map sequential_tempo;
+    const auto parallel = get_midi_events(fixture.midi_file, parallel_tempo, parallel_decoding);
+    const auto sequential = get_midi_events(fixture.midi_file, sequential_tempo, sequential_decoding);
+
+    CHECK(parallel.size() == sequential.size());
+    for (std::size_t i = 0; (i < parallel.size()) and (i < sequential.size()); ++i)
+    {
+      CHECK(parallel[i].tick == sequential[i].tick);
+      CHECK(is_same_message(parallel[i].data, sequential[i].data));
+      CHECK((i == 0) or (parallel[i - 1].tick <= parallel[i].tick));
+    }
+  }
+}
+
+static void broken_files_are_rejected()
+{
+  const auto content = read_file(fixture_path("tempo_changes.mid"));
+  temporary_directory dir;
+  const auto path = dir.path() + "/broken.mid";
+  class tempo_map tempo;
+
+  write_file(path, content.substr(0, content.size() / 2));
+  CHECK_THROWS(get_midi_events(path, tempo), std::invalid_argument);
+
+  write_file(path, content + "MTrk");
+  CHECK_THROWS(get_midi_events(path, tempo), std::invalid_argument);
+
+  write_file(path, "MThd" + content.substr(4, 10));
+  CHECK_THROWS(get_midi_events(path, tempo), std::invalid_argument);
+
+  write_file(path, "RIFF" + content.substr(4));
+  CHECK_THROWS(get_midi_events(path, tempo), std::invalid_argument);
+}
+
+void run_midi_reader_tests()
+{
+  run_test("songs match the first version", songs_match_the_first_version);
+  run_test("tracks are merged in tick order", tracks_are_merged_in_tick_order);
+  run_test("broken files are rejected", broken_files_are_rejected);
+}
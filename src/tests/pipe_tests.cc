@@ -0,0 +1,192 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include "check.hh"
+#include "mapped_file.hh"
+#include "song_loader.hh"
+#include "utils.hh"
+
+// writes some content in a named pipe, from another thread: first the
+// given number of bytes, then the rest once allowed to. A reader waiting
+// for the whole content would never allow it: the rest is written anyway
+// after a few seconds. The pipe is closed once everything is written.
+class pipe_writer
+{
+  public:
+    pipe_writer(const std::string& init_path, const std::string& content, std::size_t first_part_size)
+      : path (init_path)
+      , rest_allowed ()
+      , is_rest_allowed (false)
+      , is_rest_written (false)
+      , thread ()
+    {
+      // the reader may give up before the end, which must not kill the tests
+      std::signal(SIGPIPE, SIG_IGN);
+
+      if (mkfifo(path.c_str(), 0600) == -1)
+      {
+	throw std::runtime_error("Error: can't create the pipe " + path);
+      }
+
+      const auto can_write_rest = rest_allowed.get_future().share();
+      thread = std::thread([=] () mutable {
+	  // blocks until the reader opens the pipe
+	  const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	  if (fd == -1)
+	  {
+	    return;
+	  }
+
+	  write_all(fd, content.substr(0, first_part_size));
+	  if (first_part_size < content.size())
+	  {
+	    can_write_rest.wait_for(std::chrono::seconds{ 5 });
+	    is_rest_written = true;
+	    write_all(fd, content.substr(first_part_size));
+	  }
+	  close(fd);
+	});
+    }
+
+    ~pipe_writer()
+    {
+      allow_rest();
+      thread.join();
+      unlink(path.c_str());
+    }
+
+    pipe_writer(const pipe_writer&) = delete;
+    pipe_writer& operator=(const pipe_writer&) = delete;
+
+    bool has_written_rest() const
+    {
+      return is_rest_written;
+    }
+
+    void allow_rest()
+    {
+      if (not is_rest_allowed)
+      {
+	is_rest_allowed = true;
+	rest_allowed.set_value();
+      }
+    }
+
+  private:
+    // in small writes, for the reader to see the content come piece by piece
+    static void write_all(int fd, const std::string& bytes)
+    {
+      for (std::size_t pos = 0; pos < bytes.size(); pos += 512)
+      {
+	const auto size = std::min(bytes.size() - pos, std::size_t{ 512 });
+	if (write(fd, bytes.data() + pos, size) != static_cast<ssize_t>(size))
+	{
+	  return;
+	}
+      }
+    }
+
+    std::string path;
+    std::promise<void> rest_allowed;
+    bool is_rest_allowed;
+    std::atomic<bool> is_rest_written;
+    std::thread thread;
+};
+
+static void pipes_are_read_whole()
+{
+  temporary_directory dir;
+  const auto path = dir.path() + "/pipe";
+  const auto content = read_file(fixture_path("dense.mid"));
+  pipe_writer writer (path, content, content.size());
+
+  mapped_file file (path);
+  struct file_identity id;
+  CHECK(file.is_open());
+  CHECK(file.is_complete());
+  CHECK(std::string(file.begin(), file.end()) == content);
+  CHECK(not file.identify(id));
+}
+
+static void pipes_are_read_progressively()
+{
+  temporary_directory dir;
+  const auto path = dir.path() + "/pipe";
+  const auto content = read_file(fixture_path("dense.mid"));
+  pipe_writer writer (path, content, content.size() / 2);
+
+  mapped_file file (path, true);
+  CHECK(file.is_open());
+  CHECK(not file.is_complete());
+  while (file.size() < content.size() / 2)
+  {
+    CHECK(file.read_more());
+  }
+
+  writer.allow_rest();
+  while (file.read_more())
+  {
+  }
+  CHECK(file.is_complete());
+  CHECK(std::string(file.begin(), file.end()) == content);
+}
+
+static void songs_from_pipes_match_the_first_version()
+{
+  temporary_directory dir;
+  const auto path = dir.path() + "/pipe";
+  for (const auto& fixture : regression_fixtures())
+  {
+    const auto content = read_file(fixture.midi_file);
+    pipe_writer writer (path, content, content.size());
+
+    song_loader loader (path, song_cache(""));
+    struct song music;
+    struct song piece;
+    while (loader.next_piece(piece))
+    {
+      append_song(music, piece);
+    }
+    CHECK(describe(music) == read_file(fixture.expected_song));
+  }
+}
+
+// a single track file is decoded as it arrives, the others once entirely
+// read
+static void single_track_songs_play_as_they_arrive()
+{
+  temporary_directory dir;
+  const auto path = dir.path() + "/pipe";
+  const auto content = read_file(fixture_path("single_track.mid"));
+  pipe_writer writer (path, content, content.size() / 2);
+
+  song_loader loader (path, song_cache(""));
+  struct song music;
+  struct song piece;
+  CHECK(loader.next_piece(piece));
+  CHECK(not writer.has_written_rest());
+  append_song(music, piece);
+
+  writer.allow_rest();
+  while (loader.next_piece(piece))
+  {
+    append_song(music, piece);
+  }
+  CHECK(describe(music) == read_file(fixture_path("single_track.expected")));
+}
+
+void run_pipe_tests()
+{
+  run_test("pipes are read whole", pipes_are_read_whole);
+  run_test("pipes are read progressively", pipes_are_read_progressively);
+  run_test("songs from pipes match the first version", songs_from_pipes_match_the_first_version);
+  run_test("single track songs play as they arrive", single_track_songs_play_as_they_arrive);
+}
@@ -0,0 +1,136 @@
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include "check.hh"
+#include "mapped_file.hh"
+#include "song_cache.hh"
+#include "song_loader.hh"
+#include "utils.hh"
+
+static struct song load_song(const std::string& filename, const song_cache& cache, unsigned int& nb_pieces)
+{
+  song_loader loader (filename, cache);
+  struct song music;
+  struct song piece;
+  for (nb_pieces = 0; loader.next_piece(piece); ++nb_pieces)
+  {
+    append_song(music, piece);
+  }
+
+  return music;
+}
+
+// the entries of a cache directory
+static std::vector<std::string> entries_of(const std::string& directory)
+{
+  std::vector<std::string> res;
+  DIR* d = opendir(directory.c_str());
+  if (d != nullptr)
+  {
+    while (const struct dirent* entry = readdir(d))
+    {
+      const std::string name = entry->d_name;
+      if ((name != ".") and (name != ".."))
+      {
+	res.push_back(directory + '/' + name);
+      }
+    }
+    closedir(d);
+  }
+
+  return res;
+}
+
+// a song is stored while it is loaded, and given back as a single piece
+static void entries_round_trip()
+{
+  temporary_directory songs;
+  temporary_directory cache_dir;
+  const song_cache cache (cache_dir.path());
+
+  for (const auto& fixture : regression_fixtures())
+  {
+    const auto path = songs.path() + "/song.mid";
+    write_file(path, read_file(fixture.midi_file));
+    const auto expected = read_file(fixture.expected_song);
+
+    unsigned int nb_pieces = 0;
+    CHECK(describe(load_song(path, cache, nb_pieces)) == expected);
+    CHECK(nb_pieces > 1);
+
+    struct file_identity id;
+    struct song cached;
+    CHECK(identify_file(path, id));
+    CHECK(cache.load(path, id, cached));
+    CHECK(describe(cached) == expected);
+
+    CHECK(describe(load_song(path, cache, nb_pieces)) == expected);
+    CHECK(nb_pieces == 1);
+  }
+}
+
+// a damaged entry, or the one of a previous version of the midi file, is
+// ignored
+static void invalid_entries_are_ignored()
+{
+  temporary_directory songs;
+  temporary_directory cache_dir;
+  const song_cache cache (cache_dir.path());
+
+  const auto path = songs.path() + "/song.mid";
+  const auto content = read_file(fixture_path("tempo_changes.mid"));
+  write_file(path, content);
+
+  unsigned int nb_pieces = 0;
+  const auto expected = describe(load_song(path, cache, nb_pieces));
+
+  struct file_identity id;
+  CHECK(identify_file(path, id));
+  const auto entries = entries_of(cache_dir.path());
+  CHECK(entries.size() == 1);
+  if (entries.size() != 1)
+  {
+    return;
+  }
+
+  const auto entry = read_file(entries[0]);
+  std::vector<std::string> damaged_entries;
+  for (const auto pos : { std::size_t{ 0 }, std::size_t{ 8 }, std::size_t{ 16 }, std::size_t{ 24 },
+			  entry.size() / 2, entry.size() - 1 })
+  {
+    auto damaged = entry;
+    damaged[pos] = static_cast<char>(damaged[pos] ^ 0x10);
+    damaged_entries.push_back(damaged);
+  }
+  damaged_entries.push_back(entry.substr(0, entry.size() - 1));
+  damaged_entries.push_back(entry + '\0');
+  damaged_entries.push_back("");
+
+  for (const auto& damaged : damaged_entries)
+  {
+    struct song cached;
+    write_file(entries[0], damaged);
+    CHECK(not cache.load(path, id, cached));
+
+    // the song is decoded again instead
+    CHECK(describe(load_song(path, cache, nb_pieces)) == expected);
+    CHECK(nb_pieces > 1);
+  }
+
+  // the song was stored again by the last load
+  struct song cached;
+  CHECK(cache.load(path, id, cached));
+
+  // the entry is not the one of another file, nor of the file once changed
+  CHECK(not cache.load(songs.path() + "/other.mid", id, cached));
+  write_file(path, content + "MTrk");
+  struct file_identity new_id;
+  CHECK(identify_file(path, new_id));
+  CHECK(not cache.load(path, new_id, cached));
+}
+
+void run_song_cache_tests()
+{
+  run_test("entries round trip", entries_round_trip);
+  run_test("invalid entries are ignored", invalid_entries_are_ignored);
+}
@@ -0,0 +1,85 @@
+#include <chrono>
+#include "check.hh"
+#include "midi_reader.hh"
+#include "keyboard_events_extractor.hh"
+#include "song_checkpoints.hh"
+#include "utils.hh"
+
+static bool is_same_state(const struct playback_state& a, const struct playback_state& b)
+{
+  for (unsigned int channel = 0; channel < a.programs.size(); ++channel)
+  {
+    if (a.has_program[channel] and (a.programs[channel] != b.programs[channel]))
+    {
+      return false;
+    }
+  }
+
+  return (a.velocities == b.velocities) and (a.has_program == b.has_program) and (a.pressed_keys == b.pressed_keys);
+}
+
+// the fixture played several times in a row: a few thousand music events,
+// so a few checkpoints
+static void append_repeated_fixture(struct song& music, song_checkpoints& checkpoints)
+{
+  class tempo_map tempo;
+  const auto midi_events = get_midi_events(fixture_path("dense.mid"), tempo);
+  const auto key_events = get_key_events(midi_events, tempo);
+  const auto piece = group_events_by_time(midi_events, key_events, tempo);
+
+  for (unsigned int i = 0; i < 6; ++i)
+  {
+    auto shifted = piece;
+    const auto offset = music.events.empty() ? std::chrono::nanoseconds{ 0 }
+					     : music.events.back().time + std::chrono::nanoseconds{ 1 };
+    for (auto& ev : shifted.events)
+    {
+      ev.time += offset;
+    }
+
+    append_song(music, shifted);
+    checkpoints.extend();
+  }
+}
+
+static void states_match_a_replay_from_the_start()
+{
+  struct song music;
+  song_checkpoints checkpoints (music);
+  append_repeated_fixture(music, checkpoints);
+  CHECK(music.events.size() > 2048);
+
+  struct playback_state replayed;
+  for (std::size_t i = 0; i <= music.events.size(); ++i)
+  {
+    CHECK(is_same_state(checkpoints.state_before(i), replayed));
+    if (i < music.events.size())
+    {
+      replayed.apply(music, music.events[i]);
+    }
+  }
+
+  // past the end of the song
+  CHECK(is_same_state(checkpoints.state_before(music.events.size() + 5000), replayed));
+}
+
+static void events_are_found_by_time()
+{
+  struct song music;
+  song_checkpoints checkpoints (music);
+  CHECK(checkpoints.event_at(std::chrono::nanoseconds{ 0 }) == 0);
+
+  append_repeated_fixture(music, checkpoints);
+  for (std::size_t i = 0; i < music.events.size(); ++i)
+  {
+    CHECK(checkpoints.event_at(music.events[i].time) == i);
+    CHECK(checkpoints.event_at(music.events[i].time - std::chrono::nanoseconds{ 1 }) == i);
+  }
+  CHECK(checkpoints.event_at(music.events.back().time + std::chrono::nanoseconds{ 1 }) == music.events.size());
+}
+
+void run_song_checkpoints_tests()
+{
+  run_test("states match a replay from the start", states_match_a_replay_from_the_start);
+  run_test("events are found by time", events_are_found_by_time);
+}
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "check.hh"
+#include "midi_reader.hh"
+#include "song_loader.hh"
+#include "utils.hh"
+
+static struct song load_piece_by_piece(const std::string& filename, unsigned int& nb_pieces)
+{
+  song_loader loader (filename, song_cache(""));
+  struct song music;
+  struct song piece;
+  for (nb_pieces = 0; loader.next_piece(piece); ++nb_pieces)
+  {
+    append_song(music, piece);
+  }
+
+  return music;
+}
+
+// cutting the song into pieces changes nothing, not even the key releases
+// advanced across two pieces
+static void streamed_songs_match_the_first_version()
+{
+  for (const auto& fixture : regression_fixtures())
+  {
+    unsigned int nb_pieces = 0;
+    CHECK(describe(load_piece_by_piece(fixture.midi_file, nb_pieces)) == read_file(fixture.expected_song));
+    CHECK(nb_pieces > 1);
+  }
+}
+
+static void the_stream_stops_at_the_requested_time()
+{
+  class tempo_map whole_tempo;
+  const auto whole = get_midi_events(fixture_path("tempo_changes.mid"), whole_tempo);
+
+  midi_event_stream stream (fixture_path("tempo_changes.mid"));
+  std::vector<struct midi_event> events;
+  CHECK(stream.read_until(std::chrono::nanoseconds{ -1 }, events));
+  CHECK(events.empty());
+
+  std::chrono::nanoseconds limit { 0 };
+  bool has_more = true;
+  while (has_more)
+  {
+    const auto previous_limit = limit;
+    limit += std::chrono::milliseconds{ 100 };
+
+    const auto first_new_event = events.size();
+    has_more = stream.read_until(limit, events);
+    for (auto i = first_new_event; i < events.size(); ++i)
+    {
+      const auto time = stream.tempo().time_of(events[i].tick);
+      CHECK((time <= limit) and ((first_new_event == 0) or (time > previous_limit)));
+    }
+  }
+
+  CHECK(events.size() == whole.size());
+  for (std::size_t i = 0; (i < events.size()) and (i < whole.size()); ++i)
+  {
+    CHECK(events[i].tick == whole[i].tick);
+    CHECK(stream.tempo().time_of(events[i].tick) == whole_tempo.time_of(whole[i].tick));
+  }
+}
+
+// the pieces before the error are given first
+static void errors_come_after_the_valid_pieces()
+{
+  const auto content = read_file(fixture_path("single_track.mid"));
+  temporary_directory dir;
+  const auto path = dir.path() + "/truncated.mid";
+  write_file(path, content.substr(0, content.size() / 2));
+
+  song_loader loader (path, song_cache(""));
+  struct song music;
+  struct song piece;
+  CHECK_THROWS(while (loader.next_piece(piece)) { append_song(music, piece); }, std::invalid_argument);
+  CHECK(not music.events.empty());
+}
+
+void run_song_loader_tests()
+{
+  run_test("streamed songs match the first version", streamed_songs_match_the_first_version);
+  run_test("the stream stops at the requested time", the_stream_stops_at_the_requested_time);
+  run_test("errors come after the valid pieces", errors_come_after_the_valid_pieces);
+}
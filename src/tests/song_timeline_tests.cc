@@ -0,0 +1,78 @@
+#include <chrono>
+#include "check.hh"
+#include "song_timeline.hh"
+
+using std::chrono::nanoseconds;
+using std::chrono::milliseconds;
+
+static struct song_timeline started_at(nanoseconds origin)
+{
+  return { origin, false, nanoseconds{ 0 }, 100 };
+}
+
+static void deadlines_follow_the_song_time()
+{
+  const auto timeline = started_at(milliseconds{ 1000 });
+  CHECK(timeline.deadline_of(milliseconds{ 0 }) == milliseconds{ 1000 });
+  CHECK(timeline.deadline_of(milliseconds{ 2500 }) == milliseconds{ 3500 });
+  CHECK(timeline.song_time_at(milliseconds{ 3500 }) == milliseconds{ 2500 });
+}
+
+// the song time stops during a pause, and the deadlines move by its length
+static void a_pause_shifts_the_deadlines()
+{
+  auto timeline = started_at(milliseconds{ 1000 });
+  timeline.pause(milliseconds{ 5000 });
+  timeline.pause(milliseconds{ 6000 }); // already paused
+  CHECK(timeline.song_time_at(milliseconds{ 9000 }) == milliseconds{ 4000 });
+
+  timeline.resume(milliseconds{ 8000 });
+  timeline.resume(milliseconds{ 8500 }); // already playing
+  CHECK(not timeline.is_paused);
+  CHECK(timeline.song_time_at(milliseconds{ 8000 }) == milliseconds{ 4000 });
+  CHECK(timeline.deadline_of(milliseconds{ 5000 }) == milliseconds{ 9000 });
+}
+
+// a speed change keeps the current song time, only what follows goes
+// faster or slower
+static void a_speed_change_continues_the_song()
+{
+  auto timeline = started_at(milliseconds{ 1000 });
+  timeline.set_speed(200, milliseconds{ 3000 });
+  CHECK(timeline.song_time_at(milliseconds{ 3000 }) == milliseconds{ 2000 });
+  CHECK(timeline.deadline_of(milliseconds{ 4000 }) == milliseconds{ 4000 });
+
+  timeline.set_speed(50, milliseconds{ 4000 });
+  CHECK(timeline.song_time_at(milliseconds{ 4000 }) == milliseconds{ 4000 });
+  CHECK(timeline.deadline_of(milliseconds{ 5000 }) == milliseconds{ 6000 });
+
+  // while paused
+  timeline.pause(milliseconds{ 6000 });
+  timeline.set_speed(100, milliseconds{ 7000 });
+  CHECK(timeline.song_time_at(milliseconds{ 7000 }) == milliseconds{ 5000 });
+  timeline.resume(milliseconds{ 8000 });
+  CHECK(timeline.song_time_at(milliseconds{ 9000 }) == milliseconds{ 6000 });
+}
+
+static void a_seek_moves_the_song_time()
+{
+  auto timeline = started_at(milliseconds{ 1000 });
+  timeline.move_to(milliseconds{ 60000 }, milliseconds{ 2000 });
+  CHECK(timeline.song_time_at(milliseconds{ 3000 }) == milliseconds{ 61000 });
+  CHECK(timeline.deadline_of(milliseconds{ 60500 }) == milliseconds{ 2500 });
+
+  // a seek while paused stays paused on the new song time
+  timeline.pause(milliseconds{ 4000 });
+  timeline.move_to(milliseconds{ 10000 }, milliseconds{ 5000 });
+  CHECK(timeline.song_time_at(milliseconds{ 7000 }) == milliseconds{ 10000 });
+  timeline.resume(milliseconds{ 7000 });
+  CHECK(timeline.song_time_at(milliseconds{ 8000 }) == milliseconds{ 11000 });
+}
+
+void run_song_timeline_tests()
+{
+  run_test("deadlines follow the song time", deadlines_follow_the_song_time);
+  run_test("a pause shifts the deadlines", a_pause_shifts_the_deadlines);
+  run_test("a speed change continues the song", a_speed_change_continues_the_song);
+  run_test("a seek moves the song time", a_seek_moves_the_song_time);
+}
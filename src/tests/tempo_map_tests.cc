@@ -0,0 +1,94 @@
+#include <chrono>
+#include <random>
+#include <limits>
+#include <stdexcept>
+#include "check.hh"
+#include "tempo_map.hh"
+
+using std::chrono::nanoseconds;
+using std::chrono::milliseconds;
+
+static void ticks_follow_the_tempo_changes()
+{
+  // 120 beats per minute until the first tempo change
+  class tempo_map tempo (480, tempo_style::metrical_timing);
+  CHECK(tempo.time_of(480) == milliseconds{ 500 });
+
+  tempo.add_tempo_change(960, 250000);
+  tempo.add_tempo_change(1920, 1000000);
+  tempo.add_tempo_change(1920, 2000000); // replaces the previous one
+  CHECK(tempo.time_of(960) == milliseconds{ 1000 });
+  CHECK(tempo.time_of(1440) == milliseconds{ 1250 });
+  CHECK(tempo.time_of(1920) == milliseconds{ 1500 });
+  CHECK(tempo.time_of(2400) == milliseconds{ 3500 });
+
+  CHECK(tempo.tick_of(milliseconds{ 1250 }) == 1440);
+  CHECK(tempo.tick_of(milliseconds{ 1250 } - nanoseconds{ 1 }) == 1439);
+  CHECK(tempo.tick_of(milliseconds{ 3500 }) == 2400);
+  CHECK(tempo.tick_of(nanoseconds{ 0 }) == 0);
+}
+
+// a tick lasts a frame subdivision, whatever the tempo events say
+static void timecode_ticks_have_a_fixed_duration()
+{
+  class tempo_map tempo (25 * 40, tempo_style::timecode);
+  tempo.add_tempo_change(100, 1);
+  CHECK(tempo.time_of(1) == milliseconds{ 1 });
+  CHECK(tempo.time_of(1500) == milliseconds{ 1500 });
+  CHECK(tempo.tick_of(milliseconds{ 1500 }) == 1500);
+}
+
+// tick_of(time) is the last tick at or before time, on random tempo maps,
+// extreme tickdivs and tempos included
+static void conversions_round_trip()
+{
+  std::mt19937_64 random (1);
+  for (unsigned int round = 0; round < 500; ++round)
+  {
+    const auto tickdiv = static_cast<uint16_t>(1 + random() % ((round % 3 == 0) ? 65535 : 960));
+    class tempo_map tempo (tickdiv, (round % 7 == 0) ? tempo_style::timecode : tempo_style::metrical_timing);
+
+    uint64_t last_tick = 0;
+    for (unsigned int i = 0; i < 20; ++i)
+    {
+      last_tick += random() % 5000;
+      tempo.add_tempo_change(last_tick, static_cast<uint32_t>(1 + random() % ((round % 2 == 0) ? 16777215 : 2000)));
+    }
+
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+      const auto tick = random() % (last_tick + 10000);
+      const auto time = tempo.time_of(tick);
+      const auto back = tempo.tick_of(time);
+      CHECK(back >= tick);
+      CHECK(tempo.time_of(back) == time);
+      CHECK(tempo.time_of(back + 1) > time);
+
+      const auto any_time = nanoseconds{ static_cast<nanoseconds::rep>(random() % static_cast<uint64_t>(time.count() + 1000000)) };
+      const auto any_tick = tempo.tick_of(any_time);
+      CHECK(tempo.time_of(any_tick) <= any_time);
+      CHECK(tempo.time_of(any_tick + 1) > any_time);
+    }
+
+    CHECK(tempo.tick_of(nanoseconds::max()) > last_tick);
+  }
+}
+
+static void invalid_tempos_are_rejected()
+{
+  CHECK_THROWS(tempo_map(0, tempo_style::metrical_timing), std::invalid_argument);
+
+  class tempo_map tempo (96, tempo_style::metrical_timing);
+  CHECK_THROWS(tempo.add_tempo_change(10, 0), std::invalid_argument);
+  tempo.add_tempo_change(10, 500000);
+  CHECK_THROWS(tempo.add_tempo_change(9, 500000), std::runtime_error);
+  CHECK_THROWS(tempo.tick_of(nanoseconds{ -1 }), std::invalid_argument);
+}
+
+void run_tempo_map_tests()
+{
+  run_test("ticks follow the tempo changes", ticks_follow_the_tempo_changes);
+  run_test("timecode ticks have a fixed duration", timecode_ticks_have_a_fixed_duration);
+  run_test("conversions round trip", conversions_round_trip);
+  run_test("invalid tempos are rejected", invalid_tempos_are_rejected);
+}
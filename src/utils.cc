@@ -4,8 +4,9 @@
 #include <string>
 #include <cstddef> // for std::size_t
 #include "utils.hh"
+#include "tempo_map.hh"
 
-bool is_key_down_event(const std::vector<uint8_t>& data)
+bool is_key_down_event(const midi_message& data)
 {
   return (data.size() == 3) and
          ((data[0] & 0xF0) == 0x90) and (data[2] != 0x00);
@@ -16,7 +17,7 @@ bool is_key_down_event(const struct midi_event& ev)
   return is_key_down_event(ev.data);
 }
 
-bool is_key_release_event(const std::vector<uint8_t>& data)
+bool is_key_release_event(const midi_message& data)
 {
   return (data.size() == 3) and
     (((data[0] & 0xF0) == 0x80) or
@@ -107,7 +108,6 @@ midi_to_key_events(const std::vector<uint8_t>& message_stream)
 
   const auto size = message_stream.size();
   auto nb_read = decltype(size){0};
-  const auto stream_begin = message_stream.begin();
 
   while (nb_read < size)
   {
@@ -124,8 +124,7 @@ midi_to_key_events(const std::vector<uint8_t>& message_stream)
 
     if (this_event_size == 3) // can it be a midi key press or key release event?
     {
-      const auto tmp = std::vector<uint8_t>(std::next(stream_begin, static_cast<int>(nb_read)),
-					    std::next(stream_begin, static_cast<int>(nb_read + 3)));
+      const auto tmp = midi_message(message_stream.data() + nb_read, 3);
       if (is_key_release_event(tmp))
       {
 	res.emplace_back(tmp[1] /* pitch */,
@@ -150,14 +149,12 @@ midi_to_key_events(const std::vector<uint8_t>& message_stream)
 // that the a key is pressed and immediately released, so not played
 // at all (which is wrong)
 static
-void fix_midi_order(std::vector<struct music_event>& music)
+void fix_midi_order(struct song& music)
 {
-  for (auto& music_event : music)
+  for (const auto& music_event : music.events)
   {
-    auto& messages = music_event.midi_messages;
-
-    const auto messages_begin = messages.begin();
-    const auto messages_end = messages.end();
+    const auto messages_begin = std::next(music.midi_messages.begin(), music_event.midi_messages_begin);
+    const auto messages_end = std::next(music.midi_messages.begin(), music_event.midi_messages_end);
 
     for (auto it = messages_begin; it != messages_end; ++it)
     {
@@ -181,61 +178,53 @@ void fix_midi_order(std::vector<struct music_event>& music)
   }
 }
 
-// a song is just a succession of music_event to be played
-std::vector<struct music_event>
-group_events_by_time(const std::vector<struct midi_event>& midi_events,
-		     const std::vector<struct key_event>& key_events)
+struct song
+group_sorted_events_by_time(const array_view<struct midi_event>& midi_events,
+			    const array_view<struct key_event>& key_events,
+			    const class tempo_map& tempo)
 {
-  std::vector<struct music_event> res;
+  struct song res;
+  res.midi_messages.reserve(midi_events.size());
+  res.key_events.reserve(key_events.size());
 
-  // totally suboptimal implementation
-  for (const auto& m : midi_events)
-  {
-    const auto ev_time = m.time;
-    auto elt = std::find_if(res.begin(), res.end(), [=] (const struct music_event& a) {
-	return a.time == ev_time;
-      });
+  // merge the two sorted streams, one music event per distinct time.
+  auto midi_it = midi_events.begin();
+  const auto midi_end = midi_events.end();
+  auto key_it = key_events.begin();
+  const auto key_end = key_events.end();
 
-    if (elt == res.end())
-    {
-      res.emplace_back(ev_time,
-		       decltype(music_event::midi_messages){m.data},
-		       decltype(music_event::key_events){});
-    }
-    else
-    {
-      elt->midi_messages.push_back(m.data);
-    }
-  }
+  const auto midi_time = [&] () {
+    return tempo.time_of(midi_it->tick);
+  };
 
-
-  for (const auto& k : key_events)
+  while ((midi_it != midi_end) or (key_it != key_end))
   {
-    const auto ev_time = k.time;
-    auto elt = std::find_if(res.begin(), res.end(), [=] (const struct music_event& a) {
-	return a.time == ev_time;
-      });
+    struct music_event ev;
+    ev.time = ((key_it == key_end) or ((midi_it != midi_end) and (midi_time() < key_it->time)))
+      ? midi_time()
+      : key_it->time;
 
-    if (elt == res.end())
+    ev.midi_messages_begin = static_cast<uint32_t>(res.midi_messages.size());
+    for (; (midi_it != midi_end) and (midi_time() == ev.time); ++midi_it)
     {
-      res.emplace_back(ev_time,
-		       decltype(music_event::midi_messages){},
-		       decltype(music_event::key_events){k.data});
+      res.midi_messages.push_back(midi_it->data);
     }
-    else
+    ev.midi_messages_end = static_cast<uint32_t>(res.midi_messages.size());
+
+    ev.key_events_begin = static_cast<uint32_t>(res.key_events.size());
+    for (; (key_it != key_end) and (key_it->time == ev.time); ++key_it)
     {
-      elt->key_events.push_back(k.data);
+      res.key_events.push_back(key_it->data);
     }
-  }
+    ev.key_events_end = static_cast<uint32_t>(res.key_events.size());
 
-  std::sort(res.begin(), res.end(), [] (const struct music_event& a, const struct music_event& b) {
-      return a.time < b.time;
-    });
+    res.events.push_back(ev);
+  }
 
   // sanity check: all elts in res must hold at least one event
-  for (const auto& elt : res)
+  for (const auto& elt : res.events)
   {
-    if (elt.midi_messages.empty() and elt.key_events.empty())
+    if ((elt.midi_messages_begin == elt.midi_messages_end) and (elt.key_events_begin == elt.key_events_end))
     {
       throw std::invalid_argument("Error: a music event does not contain any midi or key event");
     }
@@ -244,7 +233,7 @@ group_events_by_time(const std::vector<struct midi_event>& midi_events,
   // sanity check: worst case res has as many elts as midi_events + key_events
   // (each event occuring at a different time)
   const auto nb_input_events = midi_events.size() + key_events.size();
-  if (res.size() > nb_input_events)
+  if (res.events.size() > nb_input_events)
   {
     throw std::invalid_argument("Error while grouping events by time, some events just got automagically created");
   }
@@ -252,9 +241,9 @@ group_events_by_time(const std::vector<struct midi_event>& midi_events,
   // sanity check: count the total number of midi and key events in res. It must
   // match the number of parameters given in the parameters
   uint64_t nb_events = 0;
-  for (const auto& elt : res)
+  for (const auto& elt : res.events)
   {
-    nb_events += elt.midi_messages.size() + elt.key_events.size();
+    nb_events += res.midi_messages_of(elt).size() + res.key_events_of(elt).size();
   }
 
   if (nb_events > nb_input_events)
@@ -269,47 +258,25 @@ group_events_by_time(const std::vector<struct midi_event>& midi_events,
 
   // sanity check: for every two different elements in res, they must start at different time
   // since res is sorted by now, only need to check
-  for (auto i = decltype(res.size()){1}; i < res.size(); ++i)
+  for (auto i = decltype(res.events.size()){1}; i < res.events.size(); ++i)
   {
-    if (res[i].time == res[i - 1].time)
+    if (res.events[i].time == res.events[i - 1].time)
     {
       throw std::invalid_argument("Error two different group of events appears at the same time");
     }
   }
 
-  // sanity check: there must be as many release events as pressed events
-  uint64_t nb_released = 0;
-  uint64_t nb_pressed = 0;
-  for (const auto& elt : res)
-  {
-    for (const auto& k : elt.key_events)
-    {
-      if (k.ev_type == key_data::type::released)
-      {
-	nb_released++;
-      }
-      if (k.ev_type == key_data::type::pressed)
-      {
-	nb_pressed++;
-      }
-    }
-  }
-
-  if (nb_pressed != nb_released)
-  {
-    throw std::invalid_argument("Error: mismatch between key pressed and key release");
-  }
-
   // sanity check: a key release and a key pressed event with the same pitch
   // can't appear at the same time
-  for (const auto& elt : res)
+  for (const auto& elt : res.events)
   {
-    for (const auto& k : elt.key_events)
+    const auto elt_key_events = res.key_events_of(elt);
+    for (const auto& k : elt_key_events)
     {
       if (k.ev_type == key_data::type::released)
       {
   	const auto pitch = k.pitch;
-  	if (std::any_of(elt.key_events.begin(), elt.key_events.end(), [=] (const struct key_data& a) {
+  	if (std::any_of(elt_key_events.begin(), elt_key_events.end(), [=] (const struct key_data& a) {
   	      return (a.ev_type == key_data::type::pressed) and (a.pitch == pitch);
   	    }))
   	{
@@ -324,6 +291,78 @@ group_events_by_time(const std::vector<struct midi_event>& midi_events,
   return res;
 }
 
+// a song is just a succession of music_event to be played
+struct song
+group_events_by_time(const std::vector<struct midi_event>& midi_events,
+		     const std::vector<struct key_event>& key_events,
+		     const class tempo_map& tempo)
+{
+  // precondition: the midi events must be sorted by time
+  if (not std::is_sorted(midi_events.begin(), midi_events.end(), [] (const struct midi_event& a, const struct midi_event& b) {
+	return a.tick < b.tick;
+      }))
+  {
+    throw std::invalid_argument("Error: precondition failed. The midi events must be sorted by ordering time.");
+  }
+
+  // the key events are not sorted (some release events got advanced), but
+  // almost. Events occuring at the same time keep their relative order.
+  auto sorted_key_events = key_events;
+  std::stable_sort(sorted_key_events.begin(), sorted_key_events.end(), [] (const struct key_event& a, const struct key_event& b) {
+      return a.time < b.time;
+    });
+
+  auto res = group_sorted_events_by_time(array_view<struct midi_event>{ midi_events.data(), midi_events.data() + midi_events.size() },
+					 array_view<struct key_event>{ sorted_key_events.data(), sorted_key_events.data() + sorted_key_events.size() },
+					 tempo);
+
+  // sanity check: there must be as many release events as pressed events
+  uint64_t nb_released = 0;
+  uint64_t nb_pressed = 0;
+  for (const auto& k : res.key_events)
+  {
+    if (k.ev_type == key_data::type::released)
+    {
+      nb_released++;
+    }
+    if (k.ev_type == key_data::type::pressed)
+    {
+      nb_pressed++;
+    }
+  }
+
+  if (nb_pressed != nb_released)
+  {
+    throw std::invalid_argument("Error: mismatch between key pressed and key release");
+  }
+
+  return res;
+}
+
+void append_song(struct song& music, const struct song& piece)
+{
+  if ((not music.events.empty()) and (not piece.events.empty()) and
+      (piece.events.front().time <= music.events.back().time))
+  {
+    throw std::invalid_argument("Error: a piece of song must come after the previous ones");
+  }
+
+  const auto midi_messages_offset = static_cast<uint32_t>(music.midi_messages.size());
+  const auto key_events_offset = static_cast<uint32_t>(music.key_events.size());
+
+  for (auto ev : piece.events)
+  {
+    ev.midi_messages_begin += midi_messages_offset;
+    ev.midi_messages_end += midi_messages_offset;
+    ev.key_events_begin += key_events_offset;
+    ev.key_events_end += key_events_offset;
+    music.events.push_back(ev);
+  }
+
+  music.midi_messages.insert(music.midi_messages.end(), piece.midi_messages.begin(), piece.midi_messages.end());
+  music.key_events.insert(music.key_events.end(), piece.key_events.begin(), piece.key_events.end());
+}
+
 template <typename T>
 static
 void list_midi_ports(std::ostream& out, T& player, const char* direction)
@@ -355,19 +394,19 @@ void list_midi_ports(std::ostream& out, T& player, const char* direction)
 
 void list_midi_ports(std::ostream& out)
 {
-  RtMidiOut out_player;
+  RtMidiOut out_player (RtMidi::LINUX_ALSA);
   list_midi_ports(out, out_player, "output");
 
   out << "\n";
 
-  RtMidiIn in_player;
+  RtMidiIn in_player (RtMidi::LINUX_ALSA);
   list_midi_ports(out, in_player, "input");
 
 }
 
 static unsigned int get_nb_output_ports()
 {
-  RtMidiOut player;
+  RtMidiOut player (RtMidi::LINUX_ALSA);
   return player.getPortCount();
 }
 
@@ -390,7 +429,7 @@ unsigned int get_port(const std::string& s)
     // argument is not a number, let's see if it matches the name of one of the output
     for (auto i = decltype(nb_outputs){0}; i < nb_outputs; ++i)
     {
-      RtMidiOut player;
+      RtMidiOut player (RtMidi::LINUX_ALSA);
       if (s == player.getPortName(i))
       {
 	return i;
@@ -5,6 +5,7 @@
 #include <limits>
 #include <fstream>
 #include <chrono>
+#include <cstddef> // for std::size_t
 #include "midi_reader.hh"
 #include "keyboard_events_extractor.hh"
 
@@ -75,45 +76,118 @@ enum note_kind : uint8_t
 #undef octave
 
 
-using midi_message = std::vector<uint8_t>;
+// read-only view on contiguous elements owned by someone else
+template <typename T>
+struct array_view
+{
+    const T* first;
+    const T* last;
+
+    const T* begin() const
+    {
+      return first;
+    }
+
+    const T* end() const
+    {
+      return last;
+    }
+
+    std::size_t size() const
+    {
+      return static_cast<std::size_t>(last - first);
+    }
+
+    bool empty() const
+    {
+      return first == last;
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+      return first[i];
+    }
+};
 
 struct music_event
 {
-    std::chrono::nanoseconds time; // occuring time
-    std::vector<midi_message> midi_messages;
-    std::vector<struct key_data> key_events;
+    std::chrono::nanoseconds time; // occuring time, in song time (not in midi ticks)
+
+    // the midi messages and key events of a music event are stored in the
+    // song, contiguously. These are their positions: [begin, end)
+    uint32_t midi_messages_begin;
+    uint32_t midi_messages_end;
+    uint32_t key_events_begin;
+    uint32_t key_events_end;
 
     music_event()
       : time (std::numeric_limits<decltype(time)>::max())
+      , midi_messages_begin (0)
+      , midi_messages_end (0)
+      , key_events_begin (0)
+      , key_events_end (0)
+    {
+    }
+};
+
+// a song is just a succession of music_event to be played.
+//
+// The messages and key events of all the music events are stored in two flat
+// arrays instead of one pair of vectors per music event: it saves an
+// allocation per music event, and keeps the data of consecutive events next
+// to each other in memory.
+struct song
+{
+    std::vector<struct music_event> events;
+    std::vector<midi_message> midi_messages;
+    std::vector<struct key_data> key_events;
+
+    song()
+      : events ()
       , midi_messages ()
       , key_events ()
     {
     }
 
-    music_event(decltype(music_event::time) init_time,
-		decltype(music_event::midi_messages) init_midi_messages,
-		decltype(music_event::key_events) init_key_events)
-      : time (init_time)
-      , midi_messages (init_midi_messages)
-      , key_events (init_key_events)
+    array_view<midi_message> midi_messages_of(const struct music_event& ev) const
     {
+      return array_view<midi_message>{ midi_messages.data() + ev.midi_messages_begin,
+				       midi_messages.data() + ev.midi_messages_end };
+    }
+
+    array_view<struct key_data> key_events_of(const struct music_event& ev) const
+    {
+      return array_view<struct key_data>{ key_events.data() + ev.key_events_begin,
+					  key_events.data() + ev.key_events_end };
     }
 };
 
-// a song is just a succession of music_event to be played
-std::vector<struct music_event>
+struct song
 group_events_by_time(const std::vector<struct midi_event>& midi_events,
-		     const std::vector<struct key_event>& key_events);
+		     const std::vector<struct key_event>& key_events,
+		     const class tempo_map& tempo);
+
+// same as group_events_by_time, for a piece of a song: the key events must
+// already be sorted by time, and a key pressed (or released) in this piece
+// may be released (or pressed) in another one.
+struct song
+group_sorted_events_by_time(const array_view<struct midi_event>& midi_events,
+			    const array_view<struct key_event>& key_events,
+			    const class tempo_map& tempo);
 
+// appends a piece of song, occuring after the end of the song
+void append_song(struct song& music, const struct song& piece);
 
 bool is_key_down_event(const struct midi_event& ev) __attribute__((pure));
 bool is_key_release_event(const struct midi_event& ev) __attribute__((pure));
-bool is_key_down_event(const std::vector<uint8_t>& data) __attribute__((pure));
-bool is_key_release_event(const std::vector<uint8_t>& data) __attribute__((pure));
+bool is_key_down_event(const midi_message& data) __attribute__((pure));
+bool is_key_release_event(const midi_message& data) __attribute__((pure));
 
 std::vector<struct key_data>
 midi_to_key_events(const std::vector<uint8_t>& message_stream);
 
+// the ports are those of RtMidi's ALSA api, which the player and the live mode
+// open
 void list_midi_ports(std::ostream& out);
 unsigned int get_port(const std::string& s);
 